@@ -17,13 +17,26 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <istream>
+#include <thread>
 #include <vector>
 
+#include "bitcount.h"
+#include "evaluate.h"
 #include "misc.h"
+#include "movegen.h"
+#include "nn.h"
+#include "notation.h"
+#include "packedpos.h"
 #include "position.h"
+#include "rkiss.h"
 #include "search.h"
 #include "thread.h"
 #include "tt.h"
@@ -65,13 +78,311 @@ static const vector<string> Defaults = {
 };
 
 
+namespace {
+
+/// PositionStats holds what a single search of one bench position measured
+struct PositionStats {
+  string fen;
+  int64_t nodes;
+  Time::point time;
+  int depth;
+  uint64_t ttProbes, ttHits;
+  Move best;
+};
+
+
+/// SmpStats holds the totals of one thread count of the SMP scaling bench
+struct SmpStats {
+  int threads;
+  int64_t nodes;
+  Time::point time;
+  double ttdSpeedup;
+  uint64_t splits, helpers, cutoffs;
+};
+
+
+/// mean_sd() computes the mean and the sample standard deviation of 'v'
+
+void mean_sd(const vector<double>& v, double& mean, double& sd) {
+
+  double sum = 0, sq = 0;
+
+  for (double x : v)
+      sum += x;
+
+  mean = v.empty() ? 0 : sum / v.size();
+
+  for (double x : v)
+      sq += (x - mean) * (x - mean);
+
+  sd = v.size() > 1 ? sqrt(sq / (v.size() - 1)) : 0;
+}
+
+
+/// t95() returns the two sided 95% quantile of Student's t distribution with
+/// 'df' degrees of freedom, falling back to the normal one past the table.
+
+double t95(int df) {
+
+  static const double T[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+     2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+     2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+
+  return df >= 1 && df <= 30 ? T[df - 1] : 1.96;
+}
+
+
+/// json_string() quotes and escapes 's' as a JSON string
+
+string json_string(const string& s) {
+
+  string r = "\"";
+
+  for (char c : s)
+      if (c == '"' || c == '\\')
+          r += string("\\") + c;
+      else if ((unsigned char)c < 0x20)
+          r += ' ';
+      else
+          r += c;
+
+  return r + '"';
+}
+
+
+/// time_op() calls 'batch' over and over for at least 'ms' milliseconds and
+/// returns the mean time of one operation in nanoseconds. 'batch' returns the
+/// number of operations it did.
+
+volatile uint64_t Sink; // Keeps the timed results alive
+
+template<typename F>
+double time_op(F batch, int ms) {
+
+  int64_t ops = 0;
+  Time::point elapsed, start = Time::now();
+
+  do ops += batch();
+  while ((elapsed = Time::now() - start) < ms);
+
+  return 1e6 * elapsed / ops;
+}
+
+template<BitCountType Cnt>
+int64_t popcount_batch(const vector<Bitboard>& bbs) {
+
+  uint64_t sum = 0;
+
+  for (Bitboard b : bbs)
+      sum += popcount<Cnt>(b);
+
+  Sink += sum;
+  return bbs.size();
+}
+
+template<GenType Type>
+int64_t generate_batch(const vector<Position>& positions) {
+
+  ExtMove mlist[MAX_MOVES];
+  uint64_t sum = 0;
+  int64_t cnt = 0;
+
+  for (const Position& pos : positions)
+      if (Type == LEGAL || Type == EVASIONS || !pos.checkers())
+      {
+          sum += generate<Type>(pos, mlist) - mlist;
+          ++cnt;
+      }
+
+  Sink += sum;
+  return cnt;
+}
+
+
+/// TTBenchStats collects what one thread of the TT benchmark measured
+
+struct TTBenchStats {
+  uint64_t probes, hits, stores, lost;
+  vector<int64_t> latency; // Every 64th probe, in nanoseconds
+};
+
+const int TTBenchDepth  = 8;
+const int TTBenchBranch = 6;
+
+atomic<bool> TTBenchStop;
+Key TTBenchMoves[64];
+
+/// mix() scatters the bits of 'x' (splitmix64 finalizer), so that
+/// consecutive numbers give unrelated keys.
+
+Key mix(uint64_t x) {
+
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+
+/// tt_probe() and tt_store() wrap the TT calls with the counting. A store
+/// is lost when the entry is gone already at the next probe, because another
+/// thread replaced it in between.
+
+const TTEntry* tt_probe(Key key, TTBenchStats& st) {
+
+  if (st.probes++ & 63)
+      return TT.probe(key);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  const TTEntry* tte = TT.probe(key);
+  st.latency.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+  return tte;
+}
+
+void tt_store(Key key, int depth, int move, TTBenchStats& st) {
+
+  TT.store(key, VALUE_ZERO, BOUND_LOWER, Depth(depth), Move(move), VALUE_ZERO);
+  st.stores++;
+
+  if (!TT.probe(key))
+      st.lost++;
+}
+
+
+/// tt_random() probes keys drawn at random out of 'pool' different ones and
+/// stores the missing ones.
+
+void tt_random(int idx, uint64_t pool, TTBenchStats& result) {
+
+  // Count in a local copy, written back at the end, so that the threads do
+  // not share the cache lines of their counters.
+  TTBenchStats st = TTBenchStats();
+  RKISS rk(73 + idx);
+
+  while (!TTBenchStop.load(memory_order_relaxed))
+      for (int i = 0; i < 256; ++i)
+      {
+          Key key = mix(rk.rand<uint64_t>() % pool);
+
+          if (tt_probe(key, st))
+              st.hits++;
+          else
+              tt_store(key, int(key >> 8) & 15, i, st);
+      }
+
+  result = move(st);
+}
+
+
+/// tt_search() walks a synthetic game tree the way the search does: probe
+/// on entry, cut when the entry is deep enough, store on exit. Children are
+/// reached by xoring one of 32 move keys per side, so move orders transpose.
+
+void tt_search(Key key, int depth, int ply, int idx, TTBenchStats& st) {
+
+  if (TTBenchStop.load(memory_order_relaxed))
+      return;
+
+  const TTEntry* tte = tt_probe(key, st);
+
+  if (tte)
+  {
+      st.hits++;
+
+      if (tte->depth() >= depth)
+          return;
+  }
+
+  int move = 0;
+
+  for (int i = 0; depth > 0 && i < TTBenchBranch; ++i)
+  {
+      // Helpers start on different moves, as in the split point search
+      int j = (i + idx) % TTBenchBranch;
+
+      move = int((key >> (5 * j)) & 31) + 32 * (ply & 1);
+      tt_search(key ^ TTBenchMoves[move], depth - 1, ply + 1, idx, st);
+  }
+
+  tt_store(key, depth, move, st);
+}
+
+void tt_search_roots(int idx, TTBenchStats& result) {
+
+  // Local counters, as in tt_random()
+  TTBenchStats st = TTBenchStats();
+
+  // All the threads search the same trees, so that they share entries
+  for (uint64_t n = 0; !TTBenchStop.load(memory_order_relaxed); ++n)
+      tt_search(mix(n), TTBenchDepth, 0, idx, st);
+
+  result = move(st);
+}
+
+
+/// fen_benchmark() sets up every position and writes it back, 'rounds' times
+/// over the whole set, and reports the throughput. FEN strings are written
+/// back as FEN and packed records as packed records. The FEN strings have
+/// already been validated when loaded.
+
+void fen_benchmark(const vector<string>& fens, const PackedReader& packed, int rounds) {
+
+  Position pos;
+  PackedPosition pp;
+  char buf[MAX_FEN_LENGTH];
+  bool chess960 = Options["UCI_Chess960"];
+  int64_t cnt = 0, bytes = 0;
+
+  Time::point elapsed = Time::now();
+
+  for (int r = 0; r < rounds; ++r)
+  {
+      for (size_t i = 0; i < fens.size(); ++i)
+      {
+          pos.set(fens[i].c_str(), chess960, Threads.main());
+          bytes += pos.fen(buf) - buf;
+          ++cnt;
+      }
+
+      for (size_t i = 0; i < packed.size(); ++i)
+          if (pos.set(packed[i], Threads.main()))
+          {
+              pos.pack(pp);
+              bytes += sizeof(PackedPosition);
+              ++cnt;
+          }
+  }
+
+  elapsed = Time::now() - elapsed + 1; // Assure positive to avoid a 'divide by zero'
+
+  cerr << "\n==========================="
+       << "\nTotal time (ms)    : " << elapsed
+       << "\nPositions          : " << cnt
+       << "\nBytes written      : " << bytes
+       << "\nPositions/second   : " << 1000 * cnt / elapsed << endl;
+}
+
+} // namespace
+
 /// benchmark() runs a simple benchmark by letting Stockfish analyze a set
 /// of positions for a given limit each. There are five parameters; the
 /// transposition table size, the number of search threads that should
 /// be used, the limit value spent for each position (optional, default is
 /// depth 12), an optional file name where to look for positions in fen
 /// format (defaults are the positions defined above) and the type of the
-/// limit value: depth (default), time in secs or number of nodes.
+/// limit value: depth (default), time in secs or number of nodes. With limit
+/// type "fen" no search is done: the positions are parsed and written back
+/// 'limit' times to measure the FEN/EPD throughput. A file name ending in
+/// ".bin" is read as packed positions (see packedpos.h), memory mapped and
+/// used with no text parsing. The optional keywords "repeat <n>" and
+/// "json <file>" may follow: the first searches the whole set n times from
+/// a cleared hash and reports the spread of the speed, the second writes
+/// the per position metrics and the summary to a JSON file. The keyword
+/// "compare" searches the set once more with the other evaluator (NN or
+/// handcrafted) to report the speed of both. With limit type
+/// "smp" the set is searched to depth 'limit' with 1, 2, 4... threads up to
+/// the given number to measure how the split point search scales.
 /*
 x`}[N@\
 UCI::loop֐Ă΂i[U[R}h(bench)͂ŌĂ΂
@@ -89,6 +400,7 @@ void benchmark(const Position& current, istream& is) {
   string token;
   Search::LimitsType limits;
   vector<string> fens;
+  PackedReader packed;
 
   // Assign default values to missing arguments
   string ttSize    = (is >> token) ? token : "32";
@@ -96,10 +408,27 @@ void benchmark(const Position& current, istream& is) {
   string limit     = (is >> token) ? token : "13";
   string fenFile   = (is >> token) ? token : "default";
   string limitType = (is >> token) ? token : "depth";
+  string jsonFile;
+  int repeat = 1;
+  bool compare = false;
+
+  while (is >> token)
+      if (token == "repeat" && (is >> token))
+          repeat = max(stoi(token), 1);
+
+      else if (token == "json")
+          is >> jsonFile;
+
+      else if (token == "compare")
+          compare = true;
 
   Options["Hash"]    = ttSize;
   Options["Threads"] = threads;
   TT.clear();
+  Threads.clear_eval_caches();
+
+  for (Thread* th : Threads)
+      th->pawnsTable.probes = th->pawnsTable.hits = 0;
 
   if (limitType == "time")
       limits.movetime = 1000 * stoi(limit); // movetime is in ms
@@ -123,6 +452,15 @@ void benchmark(const Position& current, istream& is) {
   else if (fenFile == "current")
       fens.push_back(current.fen());
 
+  else if (fenFile.size() > 4 && fenFile.compare(fenFile.size() - 4, 4, ".bin") == 0)
+  {
+      if (!packed.open(fenFile))
+      {
+          cerr << "Unable to open file " << fenFile << endl;
+          return;
+      }
+  }
+
   else
   {
       string fen;
@@ -134,41 +472,642 @@ void benchmark(const Position& current, istream& is) {
           return;
       }
 
+      Position pos;
+      FenError err;
+
       while (getline(file, fen))
           if (!fen.empty())
-              fens.push_back(fen);
+          {
+              if (pos.set(fen, Options["UCI_Chess960"], Threads.main(), &err))
+                  fens.push_back(fen);
+              else
+                  cerr << "Skipping invalid FEN: " << fen << "\n  "
+                       << err.what << " at column " << err.offset + 1 << endl;
+          }
 
       file.close();
   }
 
-  int64_t nodes = 0;
+  if (limitType == "fen")
+  {
+      fen_benchmark(fens, packed, stoi(limit));
+      return;
+  }
+
   Search::StateStackPtr st;
-  Time::point elapsed = Time::now();
+  bool chess960 = Options["UCI_Chess960"];
+
+  for (Thread* th : Threads)
+      th->kingSafetyStats = Pawns::KingSafetyStats();
+
+  size_t total = packed.size() ? packed.size() : fens.size();
+
+  // Search the whole set once, appending what each search measured to 'stats'
+  auto run = [&](vector<PositionStats>& stats) {
+
+      int64_t nodes = 0;
+
+      for (size_t i = 0; i < total; ++i)
+      {
+          Position pos;
+          FenError err;
+
+          if (!packed.size())
+              pos.set(fens[i], chess960, Threads.main());
+
+          else if (!pos.set(packed[i], Threads.main(), &err))
+          {
+              cerr << "\nSkipping invalid record " << i + 1 << ": " << err.what << endl;
+              continue;
+          }
+
+          cerr << "\nPosition: " << i + 1 << '/' << total << endl;
+
+          PositionStats ps = PositionStats();
+          ps.fen = pos.fen();
+          ps.time = Time::now();
+
+          if (limitType == "perft")
+          {
+              ps.nodes = Search::perft(pos, limits.depth * ONE_PLY);
+              ps.depth = limits.depth;
+              cerr << "\nPerft " << limits.depth  << " leaf nodes: " << ps.nodes << endl;
+          }
+          else
+          {
+              for (Thread* th : Threads)
+                  th->ttProbes = th->ttHits = 0;
+
+              Threads.start_thinking(pos, limits, vector<Move>(), st);
+              Threads.wait_for_think_finished();
+              Output::flush(); // Keep search output ahead of the next position
+
+              ps.nodes = Search::RootPos.nodes_searched();
+              ps.depth = Threads.main()->completedDepth;
+              ps.best = Search::RootMoves.empty() ? MOVE_NONE : Search::RootMoves[0].pv[0];
+
+              for (Thread* th : Threads)
+              {
+                  ps.ttProbes += th->ttProbes;
+                  ps.ttHits += th->ttHits;
+              }
+          }
+
+          ps.time = Time::now() - ps.time;
+          nodes += ps.nodes;
+          stats.push_back(ps);
+      }
+      return nodes;
+  };
 
-  for (size_t i = 0; i < fens.size(); ++i)
+  if (limitType == "smp")
   {
-      Position pos(fens[i], Options["UCI_Chess960"], Threads.main());
+      vector<int> counts;
+      vector<PositionStats> base;
+      vector<SmpStats> results;
 
-      cerr << "\nPosition: " << i + 1 << '/' << fens.size() << endl;
+      for (int n = 1; n < stoi(threads); n *= 2)
+          counts.push_back(n);
 
-      if (limitType == "perft")
+      counts.push_back(max(stoi(threads), 1));
+
+      for (int n : counts)
       {
-          size_t cnt = Search::perft(pos, limits.depth * ONE_PLY);
-          cerr << "\nPerft " << limits.depth  << " leaf nodes: " << cnt << endl;
-          nodes += cnt;
+          Options["Threads"] = to_string(n);
+          TT.clear();
+          Threads.clear_eval_caches();
+
+          for (Thread* th : Threads)
+              th->splits = th->splitHelpers = th->splitCutoffs = 0;
+
+          SmpStats r = SmpStats();
+          vector<PositionStats> stats;
+
+          r.threads = n;
+          r.time = Time::now();
+          r.nodes = run(stats);
+          r.time = Time::now() - r.time + 1;
+
+          for (Thread* th : Threads)
+          {
+              r.splits += th->splits;
+              r.helpers += th->splitHelpers;
+              r.cutoffs += th->splitCutoffs;
+          }
+
+          if (base.empty())
+              base = stats;
+
+          // Time to depth speedup is the geometric mean over the positions
+          double logSum = 0;
+
+          for (size_t i = 0; i < stats.size(); ++i)
+              logSum += log(double(max(base[i].time, Time::point(1))) / max(stats[i].time, Time::point(1)));
+
+          r.ttdSpeedup = stats.empty() ? 1 : exp(logSum / stats.size());
+          results.push_back(r);
       }
-      else
+
+      const SmpStats& one = results[0];
+
+      cerr << "\n==========================="
+           << "\nDepth " << limits.depth << ", " << total << " positions"
+           << "\nThreads   Time(ms)        Nodes  Nodes/second  NPS x  TTD x  Extra nodes     Splits  Helpers  Cutoffs"
+           << fixed;
+
+      for (const SmpStats& r : results)
       {
-          Threads.start_thinking(pos, limits, vector<Move>(), st);
-          Threads.wait_for_think_finished();
-          nodes += Search::RootPos.nodes_searched();
+          cerr << "\n" << setw(7) << r.threads
+               << setw(11) << r.time
+               << setw(13) << r.nodes
+               << setw(14) << 1000 * r.nodes / r.time
+               << setprecision(2)
+               << setw(7) << double(r.nodes) * one.time / (double(one.nodes) * r.time)
+               << setw(7) << r.ttdSpeedup
+               << setprecision(1)
+               << setw(12) << 100.0 * (r.nodes - one.nodes) / one.nodes << '%'
+               << setw(11) << r.splits
+               << setw(9) << (r.splits ? double(r.helpers) / r.splits : 0.0)
+               << setw(8) << (r.splits ? 100.0 * r.cutoffs / r.splits : 0.0) << '%';
       }
+
+      cerr << endl;
+      return;
   }
 
+  vector<vector<PositionStats>> runs(repeat);
+  vector<Time::point> runTime(repeat);
+  vector<int64_t> runNodes(repeat);
+
+  Time::point elapsed = Time::now();
+  int64_t nodes = run(runs[0]);
   elapsed = Time::now() - elapsed + 1; // Assure positive to avoid a 'divide by zero'
 
+  runTime[0] = elapsed;
+  runNodes[0] = nodes;
+
+  uint64_t probes = 0, hits = 0, pawnProbes = 0, pawnHits = 0, kingProbes = 0, kingMisses = 0;
+
+  for (Thread* th : Threads)
+  {
+      probes += th->evalCache.probes;
+      hits += th->evalCache.hits;
+      pawnProbes += th->pawnsTable.probes;
+      pawnHits += th->pawnsTable.hits;
+      kingProbes += th->kingSafetyStats.probes;
+      kingMisses += th->kingSafetyStats.misses;
+  }
+
+  // Further runs start from the same empty tables as the first one
+  for (int r = 1; r < repeat; ++r)
+  {
+      TT.clear();
+      Threads.clear_eval_caches();
+
+      runTime[r] = Time::now();
+      runNodes[r] = run(runs[r]);
+      runTime[r] = Time::now() - runTime[r] + 1;
+  }
+
+  // Per position time over the runs, positions are the same in every run
+  vector<double> posMean(runs[0].size()), posSd(runs[0].size());
+
+  for (size_t i = 0; i < runs[0].size(); ++i)
+  {
+      vector<double> v;
+
+      for (const vector<PositionStats>& stats : runs)
+          v.push_back(double(stats[i].time));
+
+      mean_sd(v, posMean[i], posSd[i]);
+  }
+
+  cerr << "\n==========================="
+       << "\n  #        Nodes  Time(ms)  Depth  TT hits  Best";
+
+  if (repeat > 1)
+      cerr << "   Mean(ms)   Sd(ms)";
+
+  for (size_t i = 0; i < runs[0].size(); ++i)
+  {
+      const PositionStats& ps = runs[0][i];
+
+      cerr << "\n" << setw(3) << i + 1
+           << setw(13) << ps.nodes
+           << setw(10) << ps.time
+           << setw(7) << ps.depth;
+
+      if (ps.ttProbes)
+          cerr << setw(8) << 100 * ps.ttHits / ps.ttProbes << '%';
+      else
+          cerr << setw(9) << '-';
+
+      cerr << "  " << left << setw(6) << (ps.best ? move_to_uci(ps.best, chess960) : "-") << right;
+
+      if (repeat > 1)
+          cerr << fixed << setprecision(1)
+               << setw(9) << posMean[i] << setw(9) << posSd[i];
+  }
+
   cerr << "\n==========================="
        << "\nTotal time (ms) : " << elapsed
        << "\nNodes searched  : " << nodes
-       << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
+       << "\nNodes/second    : " << 1000 * nodes / elapsed;
+
+  if (probes)
+      cerr << "\nEval cache hits : " << hits << '/' << probes
+           << " (" << 100 * hits / probes << "%)";
+
+  if (pawnProbes)
+      cerr << "\nPawn hash hits  : " << pawnHits << '/' << pawnProbes
+           << " (" << 100 * pawnHits / pawnProbes << "%)";
+
+  if (kingProbes)
+      cerr << "\nKing safety miss: " << kingMisses << '/' << kingProbes
+           << " (" << 100 * kingMisses / kingProbes << "%)";
+
+  vector<double> nps, times;
+  double npsMean, npsSd, timeMean, timeSd;
+
+  for (int r = 0; r < repeat; ++r)
+  {
+      nps.push_back(1000.0 * runNodes[r] / runTime[r]);
+      times.push_back(double(runTime[r]));
+  }
+
+  mean_sd(nps, npsMean, npsSd);
+  mean_sd(times, timeMean, timeSd);
+
+  double ci = repeat > 1 ? t95(repeat - 1) * npsSd / sqrt(double(repeat)) : 0;
+  bool sameNodes = count(runNodes.begin(), runNodes.end(), nodes) == repeat;
+
+  if (repeat > 1)
+  {
+      cerr << fixed << setprecision(0)
+           << "\n==========================="
+           << "\nRuns            : " << repeat
+           << "\nTime (ms)       : " << timeMean << " +/- " << timeSd
+           << "\nNodes/second    : " << npsMean << " +/- " << npsSd
+           << "\n95% interval    : " << npsMean - ci << " - " << npsMean + ci;
+
+      if (!sameNodes)
+          cerr << "\nNodes searched differ between runs";
+  }
+
+  // Search again with the other evaluator to report the speed of both. The
+  // network gets placeholder weights when no weights file is loaded. The
+  // count is not labelled "Nodes searched" so that embed-signature in the
+  // Makefile picks only the one above.
+  bool nn = NN::Enabled;
+  bool other = compare && limitType != "perft";
+  int64_t otherNodes = 0;
+  Time::point otherElapsed = 1;
+
+  if (other)
+  {
+      if (!NN::loaded())
+          NN::init();
+
+      TT.clear();
+      Threads.clear_eval_caches();
+      NN::Enabled = !nn;
+
+      vector<PositionStats> otherStats;
+      otherElapsed = Time::now();
+      otherNodes = run(otherStats);
+      otherElapsed = Time::now() - otherElapsed + 1;
+
+      NN::Enabled = nn;
+
+      cerr << "\n==========================="
+           << (nn ? "\nHandcrafted eval" : "\nNN eval") << (NN::loaded() ? "" : " (placeholder weights)")
+           << "\nNodes           : " << otherNodes
+           << "\nNodes/second    : " << 1000 * otherNodes / otherElapsed;
+  }
+
+  cerr << endl;
+
+  if (jsonFile.empty())
+      return;
+
+  ofstream json(jsonFile);
+
+  if (!json.is_open())
+  {
+      cerr << "Unable to open file " << jsonFile << endl;
+      return;
+  }
+
+  json << fixed << setprecision(1)
+       << "{\n  \"engine\": " << json_string(engine_info())
+       << ",\n  \"parameters\": { \"hash\": " << json_string(ttSize)
+       << ", \"threads\": " << json_string(threads)
+       << ", \"limit\": " << json_string(limit)
+       << ", \"limitType\": " << json_string(limitType)
+       << ", \"positions\": " << json_string(fenFile)
+       << ", \"repeat\": " << repeat
+       << ", \"eval\": " << json_string(nn ? "nn" : "handcrafted") << " }"
+       << ",\n  \"runs\": [";
+
+  for (int r = 0; r < repeat; ++r)
+  {
+      json << (r ? "," : "") << "\n    { \"time\": " << runTime[r]
+           << ", \"nodes\": " << runNodes[r]
+           << ", \"nps\": " << nps[r]
+           << ", \"positions\": [";
+
+      for (size_t i = 0; i < runs[r].size(); ++i)
+      {
+          const PositionStats& ps = runs[r][i];
+
+          json << (i ? "," : "") << "\n      { \"fen\": " << json_string(ps.fen)
+               << ", \"nodes\": " << ps.nodes
+               << ", \"time\": " << ps.time
+               << ", \"depth\": " << ps.depth
+               << ", \"ttProbes\": " << ps.ttProbes
+               << ", \"ttHits\": " << ps.ttHits
+               << ", \"best\": " << json_string(ps.best ? move_to_uci(ps.best, chess960) : "")
+               << " }";
+      }
+
+      json << " ] }";
+  }
+
+  json << "\n  ],\n  \"summary\": { \"timeMean\": " << timeMean
+       << ", \"timeSd\": " << timeSd
+       << ", \"npsMean\": " << npsMean
+       << ", \"npsSd\": " << npsSd
+       << ", \"npsCi95\": [" << npsMean - ci << ", " << npsMean + ci << "]"
+       << ", \"sameNodes\": " << (sameNodes ? "true" : "false") << " }";
+
+  if (other)
+      json << ",\n  \"otherEval\": { \"eval\": " << json_string(nn ? "handcrafted" : "nn")
+           << ", \"nodes\": " << otherNodes
+           << ", \"time\": " << otherElapsed
+           << ", \"nps\": " << 1000 * otherNodes / otherElapsed << " }";
+
+  json << "\n}\n";
+}
+
+
+/// micro_benchmark() times the bitboard primitives, move generation,
+/// do_move()/undo_move() and evaluate() one by one on the bench positions and
+/// reports the mean time of a call. The optional argument is the time in
+/// milliseconds given to each of them (default 500). Running it with builds
+/// for different ARCH values shows which one suits a CPU best.
+
+void micro_benchmark(istream& is) {
+
+  static const char* CountNames[] = { "CNT_64", "CNT_64_MAX15", "CNT_32", "CNT_32_MAX15", "CNT_HW_POPCNT" };
+
+  string token;
+  int ms = (is >> token) ? max(stoi(token), 1) : 500;
+  int cacheSize = Options["Eval Cache"];
+  bool chess960 = Options["UCI_Chess960"];
+
+  vector<Position> positions(Defaults.size());
+  vector<vector<pair<Move, bool>>> moves(Defaults.size());
+  vector<pair<Square, Bitboard>> sliders;
+  vector<Bitboard> bbs;
+
+  for (size_t i = 0; i < Defaults.size(); ++i)
+  {
+      Position& pos = positions[i];
+      pos.set(Defaults[i], chess960, Threads.main());
+
+      for (Color c = WHITE; c <= BLACK; ++c)
+          for (PieceType pt = PAWN; pt <= KING; ++pt)
+              if (pos.pieces(c, pt))
+                  bbs.push_back(pos.pieces(c, pt));
+
+      bbs.push_back(pos.pieces());
+
+      Bitboard b = pos.pieces();
+      while (b)
+          sliders.push_back(make_pair(pop_lsb(&b), pos.pieces()));
+
+      CheckInfo ci(pos);
+
+      for (const ExtMove& em : MoveList<LEGAL>(pos))
+          moves[i].push_back(make_pair(em.move, pos.gives_check(em.move, ci)));
+  }
+
+  // Time the evaluation itself, not the lookup in the eval cache
+  if (cacheSize)
+      Options["Eval Cache"] = string("0");
+
+  Search::RootColor = WHITE;
+
+  auto report = [](const string& name, double ns) {
+      cerr << "\n" << left << setw(26) << name << right
+           << fixed << setprecision(2) << setw(10) << ns << " ns";
+  };
+
+  cerr << "\n==========================="
+       << "\nlsb/msb         : "
+#ifdef USE_BSFQ
+       << "bsf/bsr instructions"
+#else
+       << "de Bruijn tables"
+#endif
+       << "\npopcount<Full>  : " << CountNames[Full]
+       << "\npopcount<Max15> : " << CountNames[Max15]
+       << "\nEvaluation      : " << (NN::Enabled ? "NN" : "handcrafted")
+       << "\n";
+
+  report("lsb", time_op([&]() {
+      uint64_t sum = 0;
+      for (Bitboard b : bbs)
+          sum += lsb(b);
+      Sink += sum;
+      return int64_t(bbs.size());
+  }, ms));
+
+  report("msb", time_op([&]() {
+      uint64_t sum = 0;
+      for (Bitboard b : bbs)
+          sum += msb(b);
+      Sink += sum;
+      return int64_t(bbs.size());
+  }, ms));
+
+  report("pop_lsb", time_op([&]() {
+      uint64_t sum = 0;
+      int64_t cnt = 0;
+      for (Bitboard b : bbs)
+          while (b)
+          {
+              sum += pop_lsb(&b);
+              ++cnt;
+          }
+      Sink += sum;
+      return cnt;
+  }, ms));
+
+  report("popcount<CNT_64>", time_op([&]() { return popcount_batch<CNT_64>(bbs); }, ms));
+  report("popcount<CNT_64_MAX15>", time_op([&]() { return popcount_batch<CNT_64_MAX15>(bbs); }, ms));
+  report("popcount<CNT_32>", time_op([&]() { return popcount_batch<CNT_32>(bbs); }, ms));
+  report("popcount<CNT_32_MAX15>", time_op([&]() { return popcount_batch<CNT_32_MAX15>(bbs); }, ms));
+
+  if (HasPopCnt)
+      report("popcount<CNT_HW_POPCNT>", time_op([&]() { return popcount_batch<CNT_HW_POPCNT>(bbs); }, ms));
+
+  report("attacks_bb<ROOK>", time_op([&]() {
+      Bitboard sum = 0;
+      for (const pair<Square, Bitboard>& sl : sliders)
+          sum ^= attacks_bb<ROOK>(sl.first, sl.second);
+      Sink += sum;
+      return int64_t(sliders.size());
+  }, ms));
+
+  report("attacks_bb<BISHOP>", time_op([&]() {
+      Bitboard sum = 0;
+      for (const pair<Square, Bitboard>& sl : sliders)
+          sum ^= attacks_bb<BISHOP>(sl.first, sl.second);
+      Sink += sum;
+      return int64_t(sliders.size());
+  }, ms));
+
+  report("do_move + undo_move", time_op([&]() {
+      StateInfo st;
+      int64_t cnt = 0;
+      for (size_t i = 0; i < positions.size(); ++i)
+      {
+          CheckInfo ci(positions[i]);
+
+          for (const pair<Move, bool>& m : moves[i])
+          {
+              positions[i].do_move(m.first, st, ci, m.second);
+              positions[i].undo_move(m.first);
+              ++cnt;
+          }
+      }
+      return cnt;
+  }, ms));
+
+  report("generate<CAPTURES>", time_op([&]() { return generate_batch<CAPTURES>(positions); }, ms));
+  report("generate<QUIETS>", time_op([&]() { return generate_batch<QUIETS>(positions); }, ms));
+  report("generate<NON_EVASIONS>", time_op([&]() { return generate_batch<NON_EVASIONS>(positions); }, ms));
+  report("generate<LEGAL>", time_op([&]() { return generate_batch<LEGAL>(positions); }, ms));
+
+  report("evaluate", time_op([&]() {
+      int64_t sum = 0;
+      for (const Position& pos : positions)
+          sum += Eval::evaluate(pos);
+      Sink += sum;
+      return int64_t(positions.size());
+  }, ms));
+
+  cerr << endl;
+
+  if (cacheSize)
+      Options["Eval Cache"] = to_string(cacheSize);
+}
+
+
+/// tt_benchmark() hammers the transposition table from many threads with no
+/// search around it. The arguments are the hash size in MB, the number of
+/// threads, the time in milliseconds per key stream (default 2000) and the
+/// key stream: "random", "search" or "both" (default). The hash and threads
+/// default to the values of the UCI options, and the hash is limited to the
+/// range of the "Hash" option. For each stream it reports
+/// the probe and store rates, the hit rate, the stores lost to other threads
+/// and percentiles of the probe latency.
+
+void tt_benchmark(istream& is) {
+
+  string token;
+  int hash    = (is >> token) ? min(max(stoi(token), 1), 8192) : int(Options["Hash"]);
+  int threads = (is >> token) ? max(stoi(token), 1) : int(Options["Threads"]);
+  int ms      = (is >> token) ? max(stoi(token), 1) : 2000;
+  string keys = (is >> token) ? token : "both";
+
+  RKISS rk;
+
+  for (Key& k : TTBenchMoves)
+      k = rk.rand<Key>();
+
+  // Cost of reading the clock, included in every latency sample
+  vector<int64_t> overhead;
+
+  for (int i = 0; i < 1000; ++i)
+  {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      overhead.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+  }
+
+  sort(overhead.begin(), overhead.end());
+
+  TT.set_size(hash);
+
+  for (string stream : { "random", "search" })
+  {
+      if (keys != stream && keys != "both")
+          continue;
+
+      // Twice as many keys as entries, so that the table is full and probes
+      // both hit and miss. set_size() rounds down to a power of two, so use
+      // the size actually allocated.
+      uint64_t pool = 2 * uint64_t(TT.entries());
+      vector<TTBenchStats> stats(threads);
+      vector<thread> workers;
+
+      TT.clear();
+      TTBenchStop = false;
+
+      Time::point elapsed = Time::now();
+
+      for (int i = 0; i < threads; ++i)
+          if (stream == "random")
+              workers.push_back(thread(tt_random, i, pool, ref(stats[i])));
+          else
+              workers.push_back(thread(tt_search_roots, i, ref(stats[i])));
+
+      this_thread::sleep_for(chrono::milliseconds(ms));
+      TTBenchStop = true;
+
+      for (thread& th : workers)
+          th.join();
+
+      elapsed = Time::now() - elapsed + 1;
+
+      TTBenchStats total = TTBenchStats();
+
+      for (const TTBenchStats& st : stats)
+      {
+          total.probes += st.probes;
+          total.hits += st.hits;
+          total.stores += st.stores;
+          total.lost += st.lost;
+          total.latency.insert(total.latency.end(), st.latency.begin(), st.latency.end());
+      }
+
+      sort(total.latency.begin(), total.latency.end());
+
+      auto percentile = [&](double p) {
+          return total.latency.empty() ? 0 : total.latency[min(total.latency.size() - 1, size_t(p * total.latency.size()))];
+      };
+
+      cerr << "\n==========================="
+           << "\nKey stream      : " << stream
+           << "\nHash (MB)       : " << (uint64_t(TT.entries()) * sizeof(TTEntry) >> 20)
+           << "\nThreads         : " << threads
+           << "\nTotal time (ms) : " << elapsed
+           << "\nProbes/second   : " << 1000 * total.probes / elapsed
+           << "\nStores/second   : " << 1000 * total.stores / elapsed
+           << "\nProbe hits      : " << total.hits << '/' << total.probes
+           << " (" << 100 * total.hits / max(total.probes, uint64_t(1)) << "%)"
+           << "\nLost stores     : " << total.lost << '/' << total.stores
+           << " (" << 1000000 * total.lost / max(total.stores, uint64_t(1)) << " ppm)"
+           << "\nProbe latency   : p50 " << percentile(0.5)
+           << " ns, p90 " << percentile(0.9)
+           << " ns, p99 " << percentile(0.99)
+           << " ns, p99.9 " << percentile(0.999)
+           << " ns (clock read " << overhead[overhead.size() / 2] << " ns)";
+  }
+
+  cerr << endl;
+
+  TT.set_size(Options["Hash"]);
+  TT.clear();
 }
@@ -17,10 +17,18 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "bitboard.h"
+#include "position.h"
 #include "types.h"
 
 /*
@@ -195,3 +203,464 @@ namespace {
   }
 
 } // namespace
+
+
+/// Retrograde bitbases for the endgames of up to four men where each side has
+/// at most one piece besides the king (KQKP, KRKP, KPKP and everything they
+/// convert into). A table stores 2 bits per position, the result for the side
+/// to move, with the white king folded onto files A-D. Tables are solved one
+/// level at a time, the tables of a level in parallel, because captures and
+/// promotions only lead into tables of lower levels. Solved tables are cached
+/// as "<path>/<code>.bb" so that they are generated only once.
+
+namespace {
+
+  enum WDL { WDL_DRAW, WDL_WIN, WDL_LOSS };
+
+  // Generator state of a position: the low 2 bits hold the WDL once resolved
+  enum { RESOLVED = 4, ILLEGAL = 8, PENDING = 16, DRAW_EXIT = 32 };
+
+  struct BBPosition {
+    Square ksq[COLOR_NB], psq[COLOR_NB];
+    PieceType pt[COLOR_NB]; // NO_PIECE_TYPE if the side has a bare king
+    Color stm;
+  };
+
+  struct Table {
+    size_t size() const { return size_t(2 * 32 * 64 * 64) << (6 * (pt[BLACK] != NO_PIECE_TYPE)); }
+    std::string code() const;
+
+    PieceType pt[COLOR_NB];
+    std::vector<uint8_t> data; // 4 positions per byte, empty if not available
+  };
+
+  // Canonical tables have pt[WHITE] >= pt[BLACK], indexed by [pt[WHITE]][pt[BLACK]]
+  Table Tables[PIECE_TYPE_NB][PIECE_TYPE_NB];
+
+  // Tables of the same level don't depend on each other
+  const PieceType Levels[][11][2] = {
+    { { QUEEN, NO_PIECE_TYPE }, { ROOK, NO_PIECE_TYPE }, { BISHOP, NO_PIECE_TYPE },
+      { KNIGHT, NO_PIECE_TYPE } },
+    { { PAWN, NO_PIECE_TYPE }, { QUEEN, QUEEN }, { QUEEN, ROOK }, { QUEEN, BISHOP },
+      { QUEEN, KNIGHT }, { ROOK, ROOK }, { ROOK, BISHOP }, { ROOK, KNIGHT },
+      { BISHOP, BISHOP }, { BISHOP, KNIGHT }, { KNIGHT, KNIGHT } },
+    { { QUEEN, PAWN }, { ROOK, PAWN }, { BISHOP, PAWN }, { KNIGHT, PAWN } },
+    { { PAWN, PAWN } }
+  };
+
+  std::string Table::code() const {
+
+    const char* PieceChar = " PNBRQ";
+    std::string s = std::string("K") + PieceChar[pt[WHITE]] + "K" + PieceChar[pt[BLACK]];
+    s.erase(std::remove(s.begin(), s.end(), ' '), s.end());
+    return s;
+  }
+
+  Bitboard attacks(PieceType pt, Color c, Square s, Bitboard occ) {
+
+    return pt == PAWN   ? StepAttacksBB[make_piece(c, PAWN)][s]
+         : pt == BISHOP ? attacks_bb<BISHOP>(s, occ)
+         : pt == ROOK   ? attacks_bb<ROOK>(s, occ)
+         : pt == QUEEN  ? attacks_bb<BISHOP>(s, occ) | attacks_bb<ROOK>(s, occ)
+                        : StepAttacksBB[pt][s];
+  }
+
+  Bitboard occupied(const BBPosition& p) {
+
+    Bitboard b = SquareBB[p.ksq[WHITE]] | p.ksq[BLACK];
+    for (Color c = WHITE; c <= BLACK; ++c)
+        if (p.pt[c])
+            b |= p.psq[c];
+    return b;
+  }
+
+  bool attacked(const BBPosition& p, Square s, Color by, Bitboard occ) {
+
+    return   (StepAttacksBB[KING][p.ksq[by]] & s)
+          || (p.pt[by] && (attacks(p.pt[by], by, p.psq[by], occ) & s));
+  }
+
+  bool is_valid(const BBPosition& p) {
+
+    Bitboard occ = 0;
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        if (occ & p.ksq[c])
+            return false;
+        occ |= p.ksq[c];
+
+        if (!p.pt[c])
+            continue;
+
+        if (   (occ & p.psq[c])
+            || (p.pt[c] == PAWN && (rank_of(p.psq[c]) == RANK_1 || rank_of(p.psq[c]) == RANK_8)))
+            return false;
+        occ |= p.psq[c];
+    }
+    // The side not to move can't be in check, this also rejects adjacent kings
+    return !attacked(p, p.ksq[~p.stm], p.stm, occ);
+  }
+
+  // Index layout: bit 0 side to move, bits 1-5 white king (files A-D only),
+  // bits 6-11 black king, bits 12-17 white piece, bits 18-23 black piece.
+  size_t index(const BBPosition& p) {
+
+    int fold = file_of(p.ksq[WHITE]) > FILE_D ? 7 : 0;
+    Square wksq = Square(p.ksq[WHITE] ^ fold);
+    size_t idx =  p.stm
+                | (rank_of(wksq) * 4 + file_of(wksq)) << 1
+                | (p.ksq[BLACK] ^ fold) << 6;
+
+    if (p.pt[WHITE])
+        idx |= size_t(p.psq[WHITE] ^ fold) << 12;
+    if (p.pt[BLACK])
+        idx |= size_t(p.psq[BLACK] ^ fold) << 18;
+    return idx;
+  }
+
+  BBPosition decode(size_t idx, const PieceType pt[]) {
+
+    BBPosition p;
+    p.stm = Color(idx & 1);
+    p.ksq[WHITE] = File((idx >> 1) & 3) | Rank((idx >> 3) & 7);
+    p.ksq[BLACK] = Square((idx >> 6) & 63);
+    p.psq[WHITE] = pt[WHITE] ? Square((idx >> 12) & 63) : SQ_NONE;
+    p.psq[BLACK] = pt[BLACK] ? Square((idx >> 18) & 63) : SQ_NONE;
+    p.pt[WHITE] = pt[WHITE];
+    p.pt[BLACK] = pt[BLACK];
+    return p;
+  }
+
+  // Swap the colors, so that the stronger side becomes white
+  void flip(BBPosition& p) {
+
+    std::swap(p.ksq[WHITE], p.ksq[BLACK]);
+    std::swap(p.psq[WHITE], p.psq[BLACK]);
+    std::swap(p.pt[WHITE], p.pt[BLACK]);
+    for (Color c = WHITE; c <= BLACK; ++c)
+    {
+        p.ksq[c] = ~p.ksq[c];
+        if (p.pt[c])
+            p.psq[c] = ~p.psq[c];
+    }
+    p.stm = ~p.stm;
+  }
+
+  Table* table_of(BBPosition& p) {
+
+    if (p.pt[WHITE] < p.pt[BLACK])
+        flip(p);
+
+    return p.pt[WHITE] ? &Tables[p.pt[WHITE]][p.pt[BLACK]] : NULL;
+  }
+
+  // Result for the side to move of a position of an already solved table
+  WDL probe_table(BBPosition p) {
+
+    const Table* t = table_of(p);
+    if (!t) // KK
+        return WDL_DRAW;
+
+    assert(!t->data.empty());
+    size_t idx = index(p);
+    return WDL((t->data[idx / 4] >> (2 * (idx & 3))) & 3);
+  }
+
+  // Calls f(child, conversion) for each legal move of p. A conversion is a
+  // capture or a promotion, leading into another table.
+  template<typename F>
+  void for_each_move(const BBPosition& p, const F& f) {
+
+    const Color us = p.stm, them = ~us;
+    Bitboard occ = occupied(p);
+    Bitboard enemy = p.pt[them] ? SquareBB[p.psq[them]] : 0;
+    Bitboard b = StepAttacksBB[KING][p.ksq[us]] & ~(occ ^ enemy);
+
+    while (b)
+    {
+        BBPosition c = p;
+        c.ksq[us] = pop_lsb(&b);
+        c.stm = them;
+        bool capture = enemy & c.ksq[us];
+        if (capture)
+            c.pt[them] = NO_PIECE_TYPE, c.psq[them] = SQ_NONE;
+
+        if (!attacked(c, c.ksq[us], them, occupied(c)))
+            f(c, capture);
+    }
+
+    if (!p.pt[us])
+        return;
+
+    Square from = p.psq[us];
+
+    if (p.pt[us] != PAWN)
+        b = attacks(p.pt[us], us, from, occ) & ~(occ ^ enemy);
+    else
+    {
+        Square to = from + pawn_push(us);
+        b = StepAttacksBB[make_piece(us, PAWN)][from] & enemy;
+
+        if (!(occ & to))
+        {
+            b |= to;
+            if (relative_rank(us, from) == RANK_2 && !(occ & (to + pawn_push(us))))
+                b |= to + pawn_push(us);
+        }
+    }
+
+    while (b)
+    {
+        BBPosition c = p;
+        c.psq[us] = pop_lsb(&b);
+        c.stm = them;
+        bool capture = enemy & c.psq[us];
+        if (capture)
+            c.pt[them] = NO_PIECE_TYPE, c.psq[them] = SQ_NONE;
+
+        if (attacked(c, c.ksq[us], them, occupied(c)))
+            continue;
+
+        if (p.pt[us] == PAWN && relative_rank(us, c.psq[us]) == RANK_8)
+            for (PieceType pt = KNIGHT; pt <= QUEEN; ++pt)
+            {
+                c.pt[us] = pt;
+                f(c, true);
+            }
+        else
+            f(c, capture);
+    }
+  }
+
+  // Calls f(parent) for each position of the same table that could have led
+  // to p with a quiet move. Parents may be invalid, the caller checks that.
+  template<typename F>
+  void for_each_unmove(const BBPosition& p, const F& f) {
+
+    const Color us = ~p.stm;
+    Bitboard occ = occupied(p);
+    Bitboard b = StepAttacksBB[KING][p.ksq[us]] & ~occ;
+
+    while (b)
+    {
+        BBPosition c = p;
+        c.ksq[us] = pop_lsb(&b);
+        c.stm = us;
+        f(c);
+    }
+
+    if (!p.pt[us])
+        return;
+
+    Square to = p.psq[us];
+
+    if (p.pt[us] != PAWN)
+        b = attacks(p.pt[us], us, to, occ) & ~occ;
+    else
+    {
+        Square from = to - pawn_push(us);
+        b = 0;
+
+        if (relative_rank(us, to) >= RANK_3 && !(occ & from))
+        {
+            b |= from;
+            if (relative_rank(us, to) == RANK_4 && !(occ & (from - pawn_push(us))))
+                b |= from - pawn_push(us);
+        }
+    }
+
+    while (b)
+    {
+        BBPosition c = p;
+        c.psq[us] = pop_lsb(&b);
+        c.stm = us;
+        f(c);
+    }
+  }
+
+  // Solves a table whose conversions are all available. En passant captures
+  // are not generated, so positions with an en passant square are not probed.
+  void solve(Table& t) {
+
+    const size_t size = t.size();
+    std::vector<uint8_t> state(size), count(size);
+
+    // Classify mates, stalemates and the positions decided by a conversion,
+    // and count the quiet moves of the others.
+    for (size_t idx = 0; idx < size; ++idx)
+    {
+        BBPosition p = decode(idx, t.pt);
+
+        if (!is_valid(p))
+        {
+            state[idx] = ILLEGAL;
+            continue;
+        }
+
+        int moves = 0, quiet = 0;
+        bool win = false, drawExit = false;
+
+        for_each_move(p, [&](const BBPosition& c, bool conversion) {
+            ++moves;
+            if (!conversion)
+                ++quiet;
+            else
+            {
+                WDL r = probe_table(c);
+                win |= (r == WDL_LOSS);
+                drawExit |= (r == WDL_DRAW);
+            }
+        });
+
+        if (win)
+            state[idx] = RESOLVED | PENDING | WDL_WIN;
+
+        else if (!moves)
+            state[idx] = attacked(p, p.ksq[p.stm], ~p.stm, occupied(p)) ? RESOLVED | PENDING | WDL_LOSS
+                                                                       : RESOLVED | WDL_DRAW;
+        else if (!quiet)
+            state[idx] = drawExit ? RESOLVED | WDL_DRAW : RESOLVED | PENDING | WDL_LOSS;
+
+        else
+        {
+            state[idx] = drawExit ? DRAW_EXIT : 0;
+            count[idx] = uint8_t(quiet);
+        }
+    }
+
+    // Propagate wins and losses backwards until nothing changes. A parent of
+    // a loss is a win, a parent whose quiet moves all lead to wins is a loss
+    // (or a draw if a conversion draws). What is left unresolved is a draw.
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+
+        for (size_t idx = 0; idx < size; ++idx)
+            if (state[idx] & PENDING)
+            {
+                state[idx] &= ~PENDING;
+                changed = true;
+                bool loss = (state[idx] & 3) == WDL_LOSS;
+
+                for_each_unmove(decode(idx, t.pt), [&](const BBPosition& q) {
+                    size_t qi = index(q);
+                    if (state[qi] & (RESOLVED | ILLEGAL))
+                        return;
+
+                    if (loss)
+                        state[qi] = RESOLVED | PENDING | WDL_WIN;
+
+                    else if (!--count[qi])
+                        state[qi] = state[qi] & DRAW_EXIT ? RESOLVED | WDL_DRAW
+                                                          : RESOLVED | PENDING | WDL_LOSS;
+                });
+            }
+    }
+
+    t.data.assign(size / 4, 0);
+    for (size_t idx = 0; idx < size; ++idx)
+        if (state[idx] & RESOLVED)
+            t.data[idx / 4] |= (state[idx] & 3) << (2 * (idx & 3));
+  }
+
+  // Loads the table from the cache file or solves it and writes the file
+  void load_or_solve(Table& t, const std::string& path) {
+
+    std::string fname = path + "/" + t.code() + ".bb";
+    std::ifstream in(fname.c_str(), std::ios::binary);
+
+    t.data.assign(t.size() / 4, 0);
+
+    if (   in.read((char*)&t.data[0], t.data.size())
+        && in.peek() == EOF)
+        return;
+
+    solve(t);
+
+    // Without the file the table is solved again at every load, so say so
+    std::ofstream out(fname.c_str(), std::ios::binary);
+
+    if (!out.write((const char*)&t.data[0], t.data.size()))
+    {
+        std::cerr << "Unable to write bitbase file " << fname << std::endl;
+        out.close();
+        std::remove(fname.c_str());
+    }
+  }
+
+} // namespace
+
+
+/// Bitbases::init() loads (or generates) all the bitbases from/into 'path'.
+/// An empty path releases them.
+
+void Bitbases::init(const std::string& path)
+{
+  for (PieceType w = NO_PIECE_TYPE; w <= KING; ++w)
+      for (PieceType b = NO_PIECE_TYPE; b <= KING; ++b)
+      {
+          Tables[w][b].pt[WHITE] = w;
+          Tables[w][b].pt[BLACK] = b;
+          std::vector<uint8_t>().swap(Tables[w][b].data);
+      }
+
+  if (path.empty())
+      return;
+
+  size_t threadCnt = std::max(1U, std::thread::hardware_concurrency());
+
+  for (const auto& level : Levels)
+  {
+      std::vector<Table*> todo;
+      for (const auto& code : level)
+          if (code[WHITE])
+              todo.push_back(&Tables[code[WHITE]][code[BLACK]]);
+
+      std::atomic<size_t> next(0);
+      std::vector<std::thread> workers;
+
+      for (size_t i = 0; i < std::min(threadCnt, todo.size()); ++i)
+          workers.push_back(std::thread([&]() {
+              for (size_t n; (n = next++) < todo.size(); )
+                  load_or_solve(*todo[n], path);
+          }));
+
+      for (std::thread& th : workers)
+          th.join();
+  }
+}
+
+
+/// Bitbases::probe() looks up the position in the bitbases. It returns false
+/// if it is not covered, otherwise 'wdl' is set to 1, 0 or -1 if the side to
+/// move wins, draws or loses.
+
+bool Bitbases::probe(const Position& pos, int& wdl)
+{
+  if (pos.ep_square() != SQ_NONE || pos.can_castle(ALL_CASTLES))
+      return false;
+
+  BBPosition p;
+  p.stm = pos.side_to_move();
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+  {
+      Bitboard b = pos.pieces(c) & ~pos.pieces(KING);
+      if (more_than_one(b))
+          return false;
+
+      p.ksq[c] = pos.king_square(c);
+      p.psq[c] = b ? lsb(b) : SQ_NONE;
+      p.pt[c]  = b ? type_of(pos.piece_on(p.psq[c])) : NO_PIECE_TYPE;
+  }
+
+  const Table* t = table_of(p);
+  if (!t || t->data.empty())
+      return false;
+
+  size_t idx = index(p);
+  int r = (t->data[idx / 4] >> (2 * (idx & 3))) & 3;
+  wdl = r == WDL_WIN ? 1 : r == WDL_LOSS ? -1 : 0;
+  return true;
+}
@@ -260,18 +260,21 @@ Square msb(Bitboard b)
 void Bitboards::print(Bitboard b) 
 {
 
-  sync_cout;
+  std::ostringstream ss;
+
 	//for (Rank rank = RANK_8; rank >= RANK_1; --rank) {̃vOA\̂܂܏o悤ɉ
   for (Rank rank = RANK_1; rank <= RANK_8; ++rank)
   {
-      std::cout << "+---+---+---+---+---+---+---+---+" << '\n';
+      ss << "+---+---+---+---+---+---+---+---+" << '\n';
 
       for (File file = FILE_A; file <= FILE_H; ++file)
-          std::cout << "| " << (b & (file | rank) ? "X " : "  ");
+          ss << "| " << (b & (file | rank) ? "X " : "  ");
 
-      std::cout << "|\n";
+      ss << "|\n";
   }
-  std::cout << "+---+---+---+---+---+---+---+---+" << sync_endl;
+  ss << "+---+---+---+---+---+---+---+---+";
+
+  sync_cout << ss.str() << sync_endl;
 }
 
 
@@ -21,8 +21,12 @@
 #ifndef BITBOARD_H_INCLUDED
 #define BITBOARD_H_INCLUDED
 
+#include <string>
+
 #include "types.h"
 
+class Position;
+
 namespace Bitboards {
 /*
 bitboard֌W̏,main֐Ă΂Ă
@@ -44,6 +48,10 @@ namespace Bitbases {
 	IՃf[^x[X̌
 	*/
 	bool probe_kpk(Square wksq, Square wpsq, Square bksq, Color us);
+
+	/// Retrograde bitbases of up to four men, see bitbase.cpp
+	void init(const std::string& path);
+	bool probe(const Position& pos, int& wdl);
 }	//namespace Bitbases̏I
 
 
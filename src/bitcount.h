@@ -24,6 +24,12 @@
 #include <cassert>
 #include "types.h"
 
+#if defined(USE_AVX2)
+#  include <immintrin.h>
+#elif defined(__SSSE3__)
+#  include <tmmintrin.h>
+#endif
+
 enum BitCountType {
   CNT_64,
   CNT_64_MAX15,
@@ -102,4 +108,50 @@ inline int popcount<CNT_HW_POPCNT>(Bitboard b) {
 #endif
 }
 
+
+/// popcount4() counts the nonzero bits of four bitboards at once. With AVX2
+/// (or SSSE3 when there is no hardware popcnt) the four counts come out of a
+/// single nibble lookup, otherwise it falls back to the scalar popcount<>.
+inline void popcount4(const Bitboard b[4], int count[4]) {
+
+#if defined(USE_AVX2)
+
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low4 = _mm256_set1_epi8(0x0F);
+
+  __m256i v  = _mm256_loadu_si256((const __m256i*)b);
+  __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low4));
+  __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low4));
+  __m256i c  = _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+
+  count[0] = _mm256_extract_epi16(c, 0);
+  count[1] = _mm256_extract_epi16(c, 4);
+  count[2] = _mm256_extract_epi16(c, 8);
+  count[3] = _mm256_extract_epi16(c, 12);
+
+#elif defined(__SSSE3__) && !defined(USE_POPCNT)
+
+  const __m128i lookup = _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m128i low4 = _mm_set1_epi8(0x0F);
+
+  for (int i = 0; i < 4; i += 2)
+  {
+      __m128i v  = _mm_loadu_si128((const __m128i*)(b + i));
+      __m128i lo = _mm_shuffle_epi8(lookup, _mm_and_si128(v, low4));
+      __m128i hi = _mm_shuffle_epi8(lookup, _mm_and_si128(_mm_srli_epi16(v, 4), low4));
+      __m128i c  = _mm_sad_epu8(_mm_add_epi8(lo, hi), _mm_setzero_si128());
+
+      count[i]     = _mm_extract_epi16(c, 0);
+      count[i + 1] = _mm_extract_epi16(c, 4);
+  }
+
+#else
+
+  for (int i = 0; i < 4; ++i)
+      count[i] = popcount<Full>(b[i]);
+
+#endif
+}
+
 #endif // #ifndef BITCOUNT_H_INCLUDED
@@ -24,12 +24,31 @@
 */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <queue>
+#include <thread>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
 
 #include "book.h"
 #include "misc.h"
 #include "movegen.h"
+#include "notation.h"
+#include "thread.h"
+#include "ucioption.h"
 
 using namespace std;
 
@@ -370,62 +389,109 @@ namespace {
     return key;
   }
 
+  // read_entry() decodes the big-endian entry stored at p
+  Entry read_entry(const unsigned char* p) {
+
+    Entry e;
+    e.key = 0;
+    for (int i = 0; i < 8; ++i)
+        e.key = (e.key << 8) | p[i];
+
+    e.move  = uint16_t((p[8]  << 8) | p[9]);
+    e.count = uint16_t((p[10] << 8) | p[11]);
+    e.learn = (uint32_t(p[12]) << 24) | (p[13] << 16) | (p[14] << 8) | p[15];
+    return e;
+  }
 } // namespace
 /*
 rkissNXɌݎ̃V[h^ČpĂ
 think֐ŏ
 */
-PolyglotBook::PolyglotBook() : rkiss(Time::now() % 10000) 
+PolyglotBook::PolyglotBook() : data(NULL), count(0), mapLength(0), mapped(false), preloaded(false),
+                               rkiss(Time::now() % 10000)
 {}
 /*
 t@CJĂ悤ȂďI邱
 */
-PolyglotBook::~PolyglotBook() { if (is_open()) close(); }
+PolyglotBook::~PolyglotBook() { close(); }
 
 
-/// operator>>() reads sizeof(T) chars from the file's binary byte stream and
-/// converts them in a number of type T. A Polyglot book stores numbers in
-/// big-endian format.
+/// open() maps a book file with the given name after closing any existing one.
+/// The mapping is shared, so several engine processes using the same book hit
+/// the same page cache. With preload set the whole book is faulted in at once
+/// (MAP_POPULATE), which pays the cost of a slow or network mounted disk up
+/// front instead of on the first probes. Where mmap() is not available the
+/// file is read in memory in one go.
 /*
-t@CXg[ǂݍł
+probe֐Ăяo
+w肳ꂽՃt@Cǂݍ
 */
-template<typename T> PolyglotBook& PolyglotBook::operator>>(T& n) 
+bool PolyglotBook::open(const string& fName, bool preload)
 {
+  close();
 
-  n = 0;
-  for (size_t i = 0; i < sizeof(T); ++i)
-      n = T((n << 8) + ifstream::get());
+#if !defined(_WIN32)
+  int fd = ::open(fName.c_str(), O_RDONLY);
+  struct stat st;
 
-  return *this;
-}
-/*
-find_first֐Ăяo
-*this >> e;̕
-*/
-template<> PolyglotBook& PolyglotBook::operator>>(Entry& e) {
-  return *this >> e.key >> e.move >> e.count >> e.learn;
+  if (fd == -1)
+      return false;
+
+  bool ok = (fstat(fd, &st) == 0);
+
+  if (ok && st.st_size >= (off_t)sizeof(Entry))
+  {
+      int flags = MAP_SHARED;
+#  if defined(MAP_POPULATE)
+      if (preload)
+          flags |= MAP_POPULATE;
+#  endif
+      void* p = mmap(NULL, st.st_size, PROT_READ, flags, fd, 0);
+
+      if ((ok = (p != MAP_FAILED)))
+      {
+          madvise(p, st.st_size, preload ? MADV_WILLNEED : MADV_RANDOM);
+          data = (const unsigned char*)p;
+          count = st.st_size / sizeof(Entry);
+          mapLength = st.st_size;
+          mapped = true;
+      }
+  }
+
+  ::close(fd); // The mapping stays valid
+#else
+  ifstream file(fName.c_str(), ios::binary);
+  bool ok = file.is_open();
+
+  if (ok)
+  {
+      buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+      data = buffer.empty() ? NULL : (const unsigned char*)&buffer[0];
+      count = buffer.size() / sizeof(Entry);
+  }
+#endif
+
+  // On failure the name is not remembered, so next probe will retry
+  fileName = ok ? fName : "";
+  preloaded = preload;
+  return ok;
 }
 
 
-/// open() tries to open a book file with the given name after closing any
-/// exsisting one.
-/*
-probe֐Ăяo
-w肳ꂽՃt@Cǂݍ
-*/
-bool PolyglotBook::open(const string& fName) 
-{
+/// close() releases the mapping or the buffer
 
-  if (is_open()) // Cannot close an already closed file
-      close();
-	/*
-	w肳ꂽt@CoCi[hŊJtrueԂ
-	*/
-  ifstream::open(fName, ifstream::in | ifstream::binary);
+void PolyglotBook::close() {
+
+#if !defined(_WIN32)
+  if (mapped)
+      munmap(const_cast<unsigned char*>(data), mapLength);
+#endif
 
-  fileName = is_open() ? fName : "";
-  ifstream::clear(); // Reset any error flag to allow retry ifstream::open()
-  return !fileName.empty();
+  data = NULL;
+  count = mapLength = 0;
+  mapped = false;
+  buffer.clear();
+  fileName.clear();
 }
 
 
@@ -441,10 +507,15 @@ Options["Book File"]
 pickBesttrueɎw肵Ăɍ_̎Ԃ
 falsew肵Ă΃_ŎI
 */
-Move PolyglotBook::probe(const Position& pos, const string& fName, bool pickBest) 
+Move PolyglotBook::probe(const Position& pos, const string& fName, bool pickBest, bool preload)
 {
+  // Serializes the (re)mapping and the PRNG, the search itself is read only
+  std::unique_lock<std::mutex> lk(mutex);
 
-  if (fileName != fName && !open(fName))
+  if ((fileName != fName || preloaded != preload) && !open(fName, preload))
+      return MOVE_NONE;
+
+  if (!count)
       return MOVE_NONE;
 
   Entry e;
@@ -456,14 +527,18 @@ Move PolyglotBook::probe(const Position& pos, const string& fName, bool pickBest
 	/*
 	find_first֐keyYՏ(Entry)ւindexԂ
 	*/
-  seekg(find_first(key) * sizeof(Entry), ios_base::beg);
 	/*
 	whileɂ{*this >> e}Ճt@CEntryoĂ镔
 	e.key == keyŎoՏ񂪐ƂmFāA̒Վ肪
 	ꍇɂ͑ĎoApickBesttrue/falseŎoIĂ
 	*/
-  while (*this >> e, e.key == key && good())
+  for (size_t idx = find_first(key); idx < count; ++idx)
   {
+      e = read_entry(data + idx * sizeof(Entry));
+
+      if (e.key != key)
+          break;
+
       best = max(best, e.count);
       sum += e.count;
 
@@ -510,7 +585,7 @@ Move PolyglotBook::probe(const Position& pos, const string& fName, bool pickBest
 
 
 /// find_first() takes a book key as input, and does a binary search through
-/// the book file for the given key. Returns the index of the leftmost book
+/// the mapped book for the given key. Returns the index of the leftmost book
 /// entry with the same key as the input.
 /*
 probe֐Ăяo
@@ -518,37 +593,19 @@ key
 t@CkeyɃ\[gꂽԂœĂiHj悤Ȃ̂
 TɂQؒTgĂ
 */
-size_t PolyglotBook::find_first(Key key) 
+size_t PolyglotBook::find_first(Key key) const
 {
-	/*
-	seekgړ֐,ړTCYAƂȂʒu
-	seekgŃt@C̍ŌɈړĒutellg֐i݈ʒũTCYԂj
-	Ńt@C̃TCY擾
-	*/
-  seekg(0, ios::end); // Move pointer to end, so tellg() gets file's size
-	/*
-	hight@C̓o^ĂՏiEntry)
-	*/
-  size_t low = 0, mid, high = (size_t)tellg() / sizeof(Entry) - 1;
-  Entry e;
+  size_t low = 0, mid, high = count - 1;
 
-  assert(low <= high);
-	/*
-	good()iostream̏ԂԂ֐
-	*/
-  while (low < high && good())
+  assert(count && low <= high);
+
+  while (low < high)
   {
       mid = (low + high) / 2;
 
       assert(mid >= low && mid < high);
 
-      seekg(mid * sizeof(Entry), ios_base::beg);
-			/*
-			t@CXg[e(Entry\)Ƀf[^[Ă
-			*/
-      *this >> e;
-
-      if (key <= e.key)
+      if (key <= read_entry(data + mid * sizeof(Entry)).key)
           high = mid;
       else
           low = mid + 1;
@@ -558,3 +615,466 @@ size_t PolyglotBook::find_first(Key key)
 
   return low;
 }
+
+
+namespace {
+
+  // A BookRecord is a (key, move) pair seen 'count' times. Shards collect them
+  // in a flat buffer that is sorted and coalesced when full, and spilled to a
+  // sorted run file if that did not free at least half of it.
+  struct BookRecord {
+    uint64_t key;
+    uint16_t move;
+    uint32_t count;
+
+    bool operator<(const BookRecord& r) const {
+      return key < r.key || (key == r.key && move < r.move);
+    }
+  };
+
+  struct PgnGame {
+    string fen, moves;
+  };
+
+  struct Shard {
+    vector<BookRecord> records;
+    vector<string> runs;
+    size_t capacity;
+    uint64_t games, errors;
+    Thread* th;  // Positions are set up on it, one search thread per shard
+    bool failed; // A run could not be written
+  };
+
+  // Sorts the records and merges the duplicates in place
+  void coalesce(vector<BookRecord>& v) {
+
+    sort(v.begin(), v.end());
+
+    size_t n = 0;
+    for (size_t i = 0; i < v.size(); ++i)
+        if (n && v[n - 1].key == v[i].key && v[n - 1].move == v[i].move)
+            v[n - 1].count += v[i].count;
+        else
+            v[n++] = v[i];
+
+    v.resize(n);
+  }
+
+  // Writes the sorted records of the shard in a new run file
+  void spill(Shard& shard, const string& prefix, atomic<int>& runId) {
+
+    string name = prefix + ".run" + to_string(runId++);
+    ofstream file(name.c_str(), ios::binary | ios::trunc);
+
+    file.write((const char*)shard.records.data(), shard.records.size() * sizeof(BookRecord));
+
+    if (!file)
+    {
+        cerr << "Error writing " << name << endl;
+        file.close();
+        remove(name.c_str());
+        shard.failed = true;
+    }
+    else
+        shard.runs.push_back(name);
+    shard.records.clear();
+  }
+
+  void add_record(Shard& shard, Key key, uint16_t move, const string& prefix, atomic<int>& runId) {
+
+    if (shard.records.size() == shard.capacity)
+    {
+        coalesce(shard.records);
+
+        if (shard.records.size() > shard.capacity / 2)
+            spill(shard, prefix, runId);
+    }
+
+    BookRecord r = { key, move, 1 };
+    shard.records.push_back(r);
+  }
+
+  // Converts a legal Move to the Polyglot encoding, see PolyglotBook::probe()
+  uint16_t polyglot_move(Move m) {
+
+    uint16_t pm = uint16_t(to_sq(m) | (from_sq(m) << 6));
+
+    if (type_of(m) == PROMOTION)
+        pm |= (promotion_type(m) - PAWN) << 12;
+
+    return pm;
+  }
+
+  // Replays the movetext of a game and records the first maxPly positions.
+  // Comments, variations, NAGs and move numbers are skipped; parsing stops at
+  // the result token or at the first illegal move.
+  bool replay(const PgnGame& g, int maxPly, Shard& shard, const string& prefix,
+              atomic<int>& runId, bool chess960) {
+
+    static const char* StartFEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+    Position pos;
+    deque<StateInfo> states;
+
+    if (!pos.set(g.fen.empty() ? StartFEN : g.fen.c_str(), chess960, shard.th))
+        return false;
+
+    const string& t = g.moves;
+    size_t i = 0, n = t.size();
+
+    for (int ply = 0; ply < maxPly && i < n; )
+    {
+        char c = t[i];
+
+        if (isspace(c) || c == '.')
+            ++i;
+
+        else if (c == '{')
+            i = min(t.find('}', i), n - 1) + 1;
+
+        else if (c == ';')
+            i = min(t.find('\n', i), n);
+
+        else if (c == '(')
+            for (int depth = 0; i < n; ++i)
+            {
+                if (t[i] == '(')
+                    ++depth;
+                else if (t[i] == ')' && !--depth)
+                    break;
+                else if (t[i] == '{')
+                    i = min(t.find('}', i), n - 1);
+            }
+
+        else
+        {
+            size_t e = i;
+            while (e < n && !isspace(t[e]) && !strchr("{;().", t[e]))
+                ++e;
+
+            // Castling may be written with zeros, move numbers are bare
+            // digits once the dots have been split off.
+            string tok = t.substr(i, e - i);
+            i = (e == i ? i + 1 : e);
+
+            if (   tok == "1-0" || tok == "0-1" || tok == "1/2-1/2" || tok == "*")
+                break;
+
+            if (tok.empty() || tok[0] == '$' || tok.find_first_not_of("0123456789") == string::npos)
+                continue;
+
+            Move m = move_from_san(pos, tok);
+
+            if (m == MOVE_NONE)
+                return false;
+
+            add_record(shard, polyglot_key(pos), polyglot_move(m), prefix, runId);
+            states.push_back(StateInfo());
+            pos.do_move(m, states.back());
+            ++ply;
+        }
+    }
+
+    return true;
+  }
+
+  // Sequential reader of a run file
+  struct RunReader {
+    ifstream file;
+    BookRecord cur;
+
+    bool next() { return bool(file.read((char*)&cur, sizeof(BookRecord))); }
+  };
+
+  // Writes all the moves of a position, scaling the counts to 16 bits
+  void write_entries(ofstream& out, Key key, vector<pair<uint64_t, uint16_t> >& moves,
+                     uint64_t minCount, uint64_t& written) {
+
+    uint64_t best = 0;
+    for (auto& m : moves)
+        best = max(best, m.first);
+
+    sort(moves.rbegin(), moves.rend()); // Best move first, as PolyGlot does
+
+    for (auto& m : moves)
+    {
+        if (m.first < minCount)
+            continue;
+
+        uint16_t weight = uint16_t(max(uint64_t(1), best > 0xFFFF ? m.first * 0xFFFF / best : m.first));
+        unsigned char buf[16];
+
+        for (int i = 0; i < 8; ++i)
+            buf[i] = (unsigned char)(key >> (56 - 8 * i));
+
+        buf[8]  = (unsigned char)(m.second >> 8), buf[9]  = (unsigned char)m.second;
+        buf[10] = (unsigned char)(weight >> 8),   buf[11] = (unsigned char)weight;
+        buf[12] = buf[13] = buf[14] = buf[15] = 0; // Learn
+
+        out.write((const char*)buf, 16);
+        ++written;
+    }
+
+    moves.clear();
+  }
+
+} // namespace
+
+
+/// make_book() is called by the "makebook" command to build a Polyglot book out
+/// of a PGN file:
+///
+///   makebook <pgn file> <book file> [max plies] [min count] [memory MB]
+///
+/// The PGN is streamed in batches of games to one shard per search thread.
+/// Shards replay the games and aggregate (key, move) counts in a bounded
+/// buffer, spilling sorted runs to disk, that are then merged in a single
+/// pass with a heap. Memory is bounded by the given budget whatever the size
+/// of the PGN, and a move is kept only if it has been played at least
+/// 'min count' times. If a run cannot be written or read back no book is
+/// written, because its counts would be missing.
+
+void make_book(istream& is) {
+
+  string pgnFile, bookFile;
+  int maxPly = 30;
+  uint64_t minCount = 1;
+  size_t memoryMB = 256;
+
+  if (!(is >> pgnFile >> bookFile))
+  {
+      cerr << "Usage: makebook <pgn file> <book file> [max plies] [min count] [memory MB]" << endl;
+      return;
+  }
+
+  is >> maxPly >> minCount >> memoryMB;
+
+  ifstream pgn(pgnFile.c_str());
+
+  if (!pgn.is_open())
+  {
+      cerr << "Unable to open file " << pgnFile << endl;
+      return;
+  }
+
+  ofstream out(bookFile.c_str(), ios::binary | ios::trunc);
+
+  if (!out.is_open())
+  {
+      cerr << "Unable to create file " << bookFile << endl;
+      return;
+  }
+
+  const size_t BatchSize = 256;
+  size_t shardCnt = Threads.size();
+  bool chess960 = Options["UCI_Chess960"];
+  Time::point elapsed = Time::now();
+
+  vector<Shard> shards(shardCnt);
+  deque<vector<PgnGame> > queue;
+  mutex m;
+  condition_variable notEmpty, notFull;
+  bool done = false;
+  atomic<int> runId(0);
+
+  // Each shard replays on its own search thread, idle meanwhile, so that the
+  // network accumulators and the pawn table written by do_move() are not
+  // shared between the workers.
+  for (size_t idx = 0; idx < shardCnt; ++idx)
+  {
+      Shard& s = shards[idx];
+      s.capacity = max(size_t(1024), memoryMB * 1024 * 1024 / sizeof(BookRecord) / shardCnt);
+      s.records.reserve(s.capacity);
+      s.games = s.errors = 0;
+      s.th = Threads[idx];
+      s.failed = false;
+  }
+
+  vector<thread> workers;
+
+  for (size_t idx = 0; idx < shardCnt; ++idx)
+      workers.push_back(thread([&, idx]() {
+          Shard& shard = shards[idx];
+
+          while (true)
+          {
+              vector<PgnGame> batch;
+              {
+                  unique_lock<mutex> lk(m);
+                  notEmpty.wait(lk, [&]{ return done || !queue.empty(); });
+
+                  if (queue.empty())
+                      break;
+
+                  batch.swap(queue.front());
+                  queue.pop_front();
+              }
+              notFull.notify_one();
+
+              for (const PgnGame& g : batch)
+              {
+                  ++shard.games;
+                  if (!replay(g, maxPly, shard, bookFile, runId, chess960))
+                      ++shard.errors;
+              }
+          }
+
+          if (!shard.records.empty())
+          {
+              coalesce(shard.records);
+              spill(shard, bookFile, runId);
+          }
+      }));
+
+  // Producer: split the PGN in games, a tag section starts a new game
+  string line;
+  vector<PgnGame> batch;
+  PgnGame game;
+
+  while (true)
+  {
+      bool eof = !getline(pgn, line);
+      bool isTag = !eof && !line.empty() && line[0] == '[';
+
+      if ((eof || isTag) && !game.moves.empty())
+      {
+          batch.push_back(game);
+          game = PgnGame();
+      }
+
+      if (eof || batch.size() == BatchSize)
+      {
+          {
+              unique_lock<mutex> lk(m);
+              notFull.wait(lk, [&]{ return queue.size() < 2 * shardCnt; });
+              queue.push_back(vector<PgnGame>());
+              queue.back().swap(batch);
+          }
+          notEmpty.notify_one();
+      }
+
+      if (eof)
+          break;
+
+      if (isTag)
+      {
+          if (line.compare(0, 5, "[FEN ") == 0)
+          {
+              size_t b = line.find('"'), e = line.rfind('"');
+              if (b != string::npos && e > b)
+                  game.fen = line.substr(b + 1, e - b - 1);
+          }
+      }
+      else
+          game.moves += line + '\n';
+  }
+
+  {
+      unique_lock<mutex> lk(m);
+      done = true;
+  }
+  notEmpty.notify_all();
+
+  for (thread& th : workers)
+      th.join();
+
+  // Merge the sorted runs of all the shards
+  vector<string> runs;
+  uint64_t games = 0, errors = 0, written = 0, positions = 0;
+  bool failed = false;
+
+  for (Shard& s : shards)
+  {
+      runs.insert(runs.end(), s.runs.begin(), s.runs.end());
+      games += s.games;
+      errors += s.errors;
+      failed |= s.failed;
+      vector<BookRecord>().swap(s.records);
+  }
+
+  vector<RunReader> readers(runs.size());
+  auto cmp = [&](size_t a, size_t b) { return readers[b].cur < readers[a].cur; };
+  priority_queue<size_t, vector<size_t>, decltype(cmp)> heap(cmp);
+
+  for (size_t i = 0; !failed && i < runs.size(); ++i)
+  {
+      readers[i].file.open(runs[i].c_str(), ios::binary);
+
+      if (!readers[i].file.is_open())
+      {
+          cerr << "Unable to open file " << runs[i] << endl;
+          failed = true;
+      }
+      else if (readers[i].next())
+          heap.push(i);
+  }
+
+  // A lost run would silently drop counts, so do not write a partial book
+  if (failed)
+  {
+      for (size_t i = 0; i < runs.size(); ++i)
+      {
+          readers[i].file.close();
+          remove(runs[i].c_str());
+      }
+
+      out.close();
+      remove(bookFile.c_str());
+      cerr << "Book not written: a run file could not be written or read back" << endl;
+      return;
+  }
+
+  // Counts of the same move are summed in 64 bits, they can overflow a run's
+  // 32 bit counter for the first plies of a large database.
+  vector<pair<uint64_t, uint16_t> > moves;
+  Key key = 0;
+  uint16_t move = 0;
+  uint64_t count = 0;
+
+  while (!heap.empty())
+  {
+      size_t i = heap.top();
+      heap.pop();
+      BookRecord r = readers[i].cur;
+
+      if (readers[i].next())
+          heap.push(i);
+
+      if (count && key == r.key && move == r.move)
+      {
+          count += r.count;
+          continue;
+      }
+
+      if (count)
+          moves.push_back(make_pair(count, move));
+
+      if (!moves.empty() && key != r.key)
+      {
+          write_entries(out, key, moves, minCount, written);
+          ++positions;
+      }
+
+      key = r.key, move = r.move, count = r.count;
+  }
+
+  if (count)
+  {
+      moves.push_back(make_pair(count, move));
+      write_entries(out, key, moves, minCount, written);
+      ++positions;
+  }
+
+  for (size_t i = 0; i < runs.size(); ++i)
+  {
+      readers[i].file.close();
+      remove(runs[i].c_str());
+  }
+
+  out.close();
+  elapsed = Time::now() - elapsed + 1; // Assure positive to avoid a 'divide by zero'
+
+  cerr << "Games: " << games << " (" << errors << " with errors), positions: " << positions
+       << ", entries written to " << bookFile << ": " << written
+       << ", runs: " << runs.size() << ", time: " << elapsed << " ms" << endl;
+}
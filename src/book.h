@@ -20,36 +20,46 @@
 #ifndef BOOK_H_INCLUDED
 #define BOOK_H_INCLUDED
 
-#include <fstream>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "position.h"
 #include "rkiss.h"
-/*
-ifstream:ǂݍݐp̃t@CXg[pĂ
-*/
-class PolyglotBook : private std::ifstream {
+
+/// PolyglotBook probes a Polyglot opening book. The file is memory mapped where
+/// supported, so the binary search runs in place with no syscall per probe and
+/// the pages are shared by all the engine processes using the same book. A
+/// probe holds a lock, so one instance can be safely shared among threads.
+
+class PolyglotBook {
+
+  PolyglotBook(const PolyglotBook&);            // Non copyable
+  PolyglotBook& operator=(const PolyglotBook&);
+
 public:
   PolyglotBook();
  ~PolyglotBook();
-  Move probe(const Position& pos, const std::string& fName, bool pickBest);
+  Move probe(const Position& pos, const std::string& fName, bool pickBest, bool preload = false);
 
 private:
-	/*
-	>>Zq̃I[o[[h
-	ev[gp[^T́H
-	*/
-  template<typename T> PolyglotBook& operator>>(T& n);
 	/*
 	w肳ꂽt@CJÂƂłɂЂ炢Ăt@CΕ
 	w肳ꂽt@CJ
 	*/
-  bool open(const std::string& fName);
+  bool open(const std::string& fName, bool preload);
+  void close();
 	/*
 	ǖʂ琶ꂽkeyg
 	*/
-  size_t find_first(Key key);
+  size_t find_first(Key key) const;
 
+  const unsigned char* data;
+  size_t count; // Number of 16 bytes entries
+  size_t mapLength; // Bytes mapped, the file size
+  bool mapped, preloaded;
+  std::vector<unsigned char> buffer;
+  std::mutex mutex;
   RKISS rkiss;
   std::string fileName;
 };
@@ -21,6 +21,7 @@ chess
 */
 #include <algorithm>
 #include <cassert>
+#include <vector>
 
 #include "bitboard.h"
 #include "bitcount.h"
@@ -83,10 +84,29 @@ namespace {
     return sq;
   }
 
+  // Replace the heuristic 'result' of strongSide with a score matching the
+  // exact outcome when the position is covered by a loaded bitbase, and
+  // return it from the side to move's point of view.
+  Value refine(const Position& pos, Color strongSide, Value result) {
+
+    int wdl;
+    if (Bitbases::probe(pos, wdl))
+    {
+        if (strongSide != pos.side_to_move())
+            wdl = -wdl;
+
+        result = wdl > 0 ? std::max(result, VALUE_ZERO) + VALUE_KNOWN_WIN
+               : wdl < 0 ? std::min(result, VALUE_ZERO) - VALUE_KNOWN_WIN
+                         : VALUE_DRAW;
+    }
+    return strongSide == pos.side_to_move() ? result : -result;
+  }
+
   // Get the material key of a Position out of the given endgame key code
   // like "KBPKN". The trick here is to first forge an ad-hoc fen string
-  // and then let a Position object to do the work for us. Note that the
-  // fen string could correspond to an illegal position.
+  // and then let a Position object to do the work for us. The two sides are
+  // placed on the 7th and 2nd ranks, so that pawns are never on a back rank
+  // and no king is in check, as Position::set() rejects such positions.
   Key key(const string& code, Color c) 
 	{
 
@@ -98,8 +118,9 @@ namespace {
 
     std::transform(sides[c].begin(), sides[c].end(), sides[c].begin(), tolower);
 
-    string fen =  sides[0] + char('0' + int(8 - code.length()))
-                + sides[1] + "/8/8/8/8/8/8/8 w - - 0 10";
+    string fen =  "8/" + sides[0] + char('0' + int(8 - sides[0].length()))
+                + "/8/8/8/8/" + sides[1] + char('0' + int(8 - sides[1].length()))
+                + "/8 w - - 0 10";
 
     return Position(fen, false, nullptr).material_key();
   }
@@ -109,7 +130,92 @@ namespace {
 
 /// Endgames members definitions
 
-Endgames::Endgames() 
+namespace {
+
+  // Registry is a flat table of endgame functions of one return type. A slot
+  // is addressed by the bits [shift, shift + log2(size)) of the material key,
+  // with shift and size chosen by build() so that the hash is perfect: no two
+  // registered keys share a slot and a probe is a single compare.
+
+  template<typename T>
+  struct Registry {
+
+    struct Slot {
+      Key key;
+      T* eg;
+    };
+
+    void add(Key k, T* eg) { Slot s = { k, eg }; pending.push_back(s); }
+    void build();
+
+    T* probe(Key k) const {
+      const Slot& s = slots[(k >> shift) & mask];
+      return s.key == k ? s.eg : nullptr;
+    }
+
+    std::vector<Slot> pending, slots;
+    int shift;
+    Key mask;
+  };
+
+  template<typename T>
+  void Registry<T>::build() {
+
+    for (int bits = 4; ; ++bits)
+        for (shift = 0; shift <= 64 - bits; ++shift)
+        {
+            Slot empty = { 0, nullptr };
+            slots.assign(size_t(1) << bits, empty);
+            mask = (Key(1) << bits) - 1;
+
+            bool perfect = true;
+
+            for (const Slot& s : pending)
+            {
+                Slot& slot = slots[(s.key >> shift) & mask];
+
+                if (slot.eg)
+                {
+                    perfect = false;
+                    break;
+                }
+                slot = s;
+            }
+
+            if (perfect)
+            {
+                std::vector<Slot>().swap(pending);
+                return;
+            }
+        }
+  }
+
+  Registry<EndgameBase<Value>>       EvaluationFunctions;
+  Registry<EndgameBase<ScaleFactor>> ScalingFunctions;
+
+  template<typename T> Registry<T>& registry();
+  template<> Registry<EndgameBase<Value>>& registry() { return EvaluationFunctions; }
+  template<> Registry<EndgameBase<ScaleFactor>>& registry() { return ScalingFunctions; }
+
+  // add() registers the endgame function for both colors. The functors are
+  // static objects, one pair per endgame type, shared by all the threads.
+
+  template<EndgameType E, typename T = EndgameBase<typename eg_fun<E>::type>>
+  void add(const string& code) {
+
+    static Endgame<E> eg[] = { Endgame<E>(WHITE), Endgame<E>(BLACK) };
+
+    registry<T>().add(key(code, WHITE), &eg[WHITE]);
+    registry<T>().add(key(code, BLACK), &eg[BLACK]);
+  }
+
+} // namespace
+
+
+/// Endgames::init() fills the registry. It is called once at startup, after
+/// Position::init() because the material keys come from forged positions.
+
+void Endgames::init()
 {
 
   add<KPK>("KPK");
@@ -130,17 +236,25 @@ Endgames::Endgames()
   add<KBPKN>("KBPKN");
   add<KBPPKB>("KBPPKB");
   add<KRPPKRP>("KRPPKRP");
+
+  EvaluationFunctions.build();
+  ScalingFunctions.build();
 }
 
 
-template<EndgameType E, typename T>
-void Endgames::add(const string& code) 
+/// Endgames::probe() looks up the endgame function of the given material key,
+/// stores it in 'eg' and returns it, or nullptr if there is none.
+
+template<typename T>
+T* Endgames::probe(Key key, T** eg)
 {
 
-  map<T>()[key(code, WHITE)] = std::unique_ptr<T>(new Endgame<E>(WHITE));
-  map<T>()[key(code, BLACK)] = std::unique_ptr<T>(new Endgame<E>(BLACK));
+  return *eg = registry<T>().probe(key);
 }
 
+template EndgameBase<Value>* Endgames::probe(Key, EndgameBase<Value>**);
+template EndgameBase<ScaleFactor>* Endgames::probe(Key, EndgameBase<ScaleFactor>**);
+
 
 /// Mate with KX vs K. This function is used to evaluate positions with
 /// King and plenty of material vs a lone king. It simply gives the
@@ -231,7 +345,7 @@ Value Endgame<KPK>::operator()(const Position& pos) const
 /// KR vs KP. This is a somewhat tricky endgame to evaluate precisely without
 /// a bitbase. The function below returns drawish scores when the pawn is
 /// far advanced with support of the king, while the attacking king is far
-/// away.
+/// away. The exact result is used instead when the bitbase is loaded.
 template<>
 Value Endgame<KRKP>::operator()(const Position& pos) const 
 {
@@ -271,7 +385,7 @@ Value Endgame<KRKP>::operator()(const Position& pos) const
               + Value(square_distance(bksq, psq + DELTA_S) * 8)
               + Value(square_distance(psq, queeningSq) * 8);
 
-  return strongSide == pos.side_to_move() ? result : -result;
+  return refine(pos, strongSide, result);
 }
 
 
@@ -326,7 +440,7 @@ Value Endgame<KQKP>::operator()(const Position& pos) const
       || !((FileABB | FileCBB | FileFBB | FileHBB) & pawnSq))
       result += QueenValueEg - PawnValueEg;
 
-  return strongSide == pos.side_to_move() ? result : -result;
+  return refine(pos, strongSide, result);
 }
 
 
@@ -893,6 +1007,11 @@ ScaleFactor Endgame<KPKP>::operator()(const Position& pos) const
 
   Color us = strongSide == pos.side_to_move() ? WHITE : BLACK;
 
+  // An exact result, if available, beats the guesses below
+  int wdl;
+  if (Bitbases::probe(pos, wdl))
+      return wdl ? SCALE_FACTOR_NONE : SCALE_FACTOR_DRAW;
+
   // If the pawn has advanced to the fifth rank or further, and is not a
   // rook pawn, it's too dangerous to assume that it's at least a draw.
   if (rank_of(psq) >= RANK_5 && file_of(psq) != FILE_A)
@@ -25,11 +25,7 @@ chess
 #ifndef ENDGAME_H_INCLUDED
 #define ENDGAME_H_INCLUDED
 
-#include <map>
-#include <memory>
-#include <string>
 #include <type_traits>
-#include <utility>
 
 #include "position.h"
 #include "types.h"
@@ -111,27 +107,17 @@ private:
 };
 
 
-/// Endgames class stores in two std::map the std::unique_ptr to endgame
-/// evaluation and scaling base objects. Then we use polymorphism to invoke
-/// the actual endgame function calling its operator() that is virtual.
+/// Endgames is the registry of the endgame evaluation and scaling functions,
+/// indexed by material key. It is filled once at startup by init() and only
+/// read afterwards, so a single instance is shared by all the threads. Then
+/// we use polymorphism to invoke the actual endgame function calling its
+/// operator() that is virtual.
 
-class Endgames {
+namespace Endgames {
 
-  template<typename T> using Map = std::map<Key, std::unique_ptr<T>>;
+void init();
+template<typename T> T* probe(Key key, T** eg);
 
-  template<EndgameType E, typename T = EndgameBase<typename eg_fun<E>::type>>
-  void add(const std::string& code);
-
-  template<typename T, int I = std::is_same<T, EndgameBase<ScaleFactor>>::value>
-  Map<T>& map() { return std::get<I>(maps); }
-
-  std::pair<Map<EndgameBase<Value>>, Map<EndgameBase<ScaleFactor>>> maps;
-
-public:
-  Endgames();
-
-  template<typename T> T* probe(Key key, T** eg)
-  { return *eg = map<T>().count(key) ? map<T>()[key].get() : nullptr; }
-};
+}
 
 #endif // #ifndef ENDGAME_H_INCLUDED
@@ -25,6 +25,7 @@
 #include "bitcount.h"
 #include "evaluate.h"
 #include "material.h"
+#include "nn.h"
 #include "pawns.h"
 #include "thread.h"
 #include "ucioption.h"
@@ -112,6 +113,9 @@ namespace {
   enum { Mobility, PawnStructure, PassedPawns, Space, KingDangerUs, KingDangerThem };
   Score Weights[6];
 
+  // True when some evaluation weight differs from its default, see weight()
+  bool CustomWeights;
+
   typedef Value V;
   #define S(mg, eg) make_score(mg, eg)
 
@@ -125,10 +129,15 @@ namespace {
 	Joona KiiskiƂ̂͐l̖O炵
 	https://chessprogramming.wikispaces.com/Joona+Kiiski
 	*/
-  const Score WeightsInternal[] = {
+  constexpr Score WeightsInternal[] = {
       S(289, 344), S(233, 201), S(221, 273), S(46, 0), S(271, 0), S(307, 0)
   };
 
+  // With the UCI options at 100 the weights are just WeightsInternal[], so
+  // the default path folds them at compile time instead of loading Weights[].
+  template<bool Custom>
+  Score weight(int term) { return Custom ? Weights[term] : WeightsInternal[term]; }
+
   // MobilityBonus[PieceType][attacked] contains bonuses for middle and end
   // game, indexed by piece type and number of attacked squares not occupied by
   // friendly pieces.
@@ -151,6 +160,36 @@ namespace {
        S( 25, 41), S( 25, 41), S(25, 41), S(25, 41) }
   };
 
+  // MobilityBatch collects the mobility areas of the pieces of one color, so
+  // that they can be counted four at a time by popcount4().
+  struct MobilityBatch {
+
+    MobilityBatch() : size(0) {}
+
+    void add(PieceType pt, Bitboard b) { pieceType[size] = pt; area[size++] = b; }
+
+    Score score() {
+
+      Score s = SCORE_ZERO;
+      int count[4];
+
+      for (int i = size; i % 4; ++i)
+          area[i] = 0;
+
+      for (int i = 0; i < size; i += 4)
+      {
+          popcount4(area + i, count);
+          for (int j = 0; j < 4 && i + j < size; ++j)
+              s += MobilityBonus[pieceType[i + j]][count[j]];
+      }
+      return s;
+    }
+
+    Bitboard area[16]; // At most 15 pieces besides king and pawns
+    PieceType pieceType[16];
+    int size;
+  };
+
   // Outpost[PieceType][Square] contains bonuses of knights and bishops, indexed
   // by piece type and square (from white's point of view).
   const Value Outpost[][SQUARE_NB] = {
@@ -190,6 +229,12 @@ namespace {
   #undef S
 
   const Score Tempo            = make_score(24, 11);
+
+  // Lazy evaluation margin. Without queens and passed pawns the terms added
+  // after the pawn structure (pieces, mobility, king safety, threats, space
+  // and scaling) stay well within this bound, so the partial score can be
+  // returned as a bound when it is this far outside the search window.
+  const Value LazyMargin = Value(640);
   const Score BishopPin        = make_score(66, 11);
 	/*
 	ROOKRank7ɁiwhiteROOK݂jƂɂ炦{[iX
@@ -270,8 +315,8 @@ namespace {
   Score KingDanger[COLOR_NB][128];
 
   // Function prototypes
-  template<bool Trace>
-  Value do_evaluate(const Position& pos);
+  template<bool Trace, bool Custom>
+  Value do_evaluate(const Position& pos, Value alpha, Value beta);
 
   template<Color Us>
   void init_eval_info(const Position& pos, EvalInfo& ei);
@@ -285,7 +330,7 @@ namespace {
   template<Color Us, bool Trace>
   Score evaluate_threats(const Position& pos, const EvalInfo& ei);
 
-  template<Color Us, bool Trace>
+  template<Color Us, bool Trace, bool Custom>
   Score evaluate_passed_pawns(const Position& pos, const EvalInfo& ei);
 
   template<Color Us>
@@ -304,13 +349,77 @@ namespace Eval {
 
   /// evaluate() is the main evaluation function. It always computes two
   /// values, an endgame score and a middle game score, and interpolates
-  /// between them based on the remaining material.
+  /// between them based on the remaining material. As in search the result
+  /// is fail-soft: a value <= alpha or >= beta may be only a bound, because
+  /// the evaluation stops early when the score is clearly outside the window.
 	/*
 	OĂ΂̂͂̊֐
 	*/
-  Value evaluate(const Position& pos) 
+  Value evaluate(const Position& pos, Value alpha, Value beta)
 	{
-    return do_evaluate<false>(pos);
+    if (NN::Enabled)
+        return NN::evaluate(pos);
+
+    Cache& cache = pos.this_thread()->evalCache;
+
+    if (!cache.enabled())
+        return CustomWeights ? do_evaluate<false, true>(pos, alpha, beta)
+                             : do_evaluate<false, false>(pos, alpha, beta);
+
+    CacheEntry* e = cache.first_entry(pos.key());
+    uint32_t key32 = uint32_t(pos.key() >> 32) ^ uint32_t(Search::RootColor);
+
+    ++cache.probes;
+
+    if (e->key32 == key32)
+    {
+        ++cache.hits;
+        return Value(e->value);
+    }
+
+    Value v = CustomWeights ? do_evaluate<false, true>(pos, alpha, beta)
+                            : do_evaluate<false, false>(pos, alpha, beta);
+
+    // Only exact values can be cached
+    if (v > alpha && v < beta)
+    {
+        e->key32 = key32;
+        e->value = v;
+    }
+    return v;
+  }
+
+
+  /// Cache::resize() sets the cache size to the largest power of two number of
+  /// entries fitting in 'mbSize' megabytes. The cache is cleared only if its
+  /// size actually changes.
+
+  void Cache::resize(size_t mbSize) {
+
+    size_t newSize = 0;
+
+    if (mbSize)
+    {
+        newSize = 1;
+        while (2 * newSize * sizeof(CacheEntry) <= (mbSize << 20))
+            newSize *= 2;
+    }
+
+    if (newSize == entries.size())
+        return;
+
+    std::vector<CacheEntry>(newSize, CacheEntry()).swap(entries);
+    mask = uint32_t(newSize ? newSize - 1 : 0);
+  }
+
+
+  /// Cache::clear() invalidates all the entries, needed when the evaluation
+  /// weights change, and resets the statistics.
+
+  void Cache::clear() {
+
+    std::fill(entries.begin(), entries.end(), CacheEntry());
+    probes = hits = 0;
   }
 
 
@@ -345,6 +454,11 @@ namespace Eval {
     Weights[Space]          = weight_option("Space", "Space", WeightsInternal[Space]);
     Weights[KingDangerUs]   = weight_option("Cowardice", "Cowardice", WeightsInternal[KingDangerUs]);
     Weights[KingDangerThem] = weight_option("Aggressiveness", "Aggressiveness", WeightsInternal[KingDangerThem]);
+
+    // King danger weights are baked into KingDanger[] below
+    CustomWeights = false;
+    for (int i = Mobility; i <= Space; ++i)
+        CustomWeights |= (Weights[i] != WeightsInternal[i]);
 		/*
 		MaxSlope,PeakƂ킩ĂȂ
 		*/
@@ -367,8 +481,8 @@ namespace Eval {
 
 namespace {
 
-template<bool Trace>
-Value do_evaluate(const Position& pos) 
+template<bool Trace, bool Custom>
+Value do_evaluate(const Position& pos, Value alpha, Value beta) 
 {
 
   assert(!pos.checkers());
@@ -389,7 +503,7 @@ Value do_evaluate(const Position& pos)
 	/*
 	IՌŗL̕]lvZ
 	*/
-  ei.mi = Material::probe(pos, th->materialTable, th->endgames);
+  ei.mi = Material::probe(pos, th->materialTable);
   score += ei.mi->material_value();
 
   // If we have a specialized evaluation function for the current material
@@ -411,7 +525,30 @@ Value do_evaluate(const Position& pos)
 	PawnŗL̕]l
 	*/
   ei.pi = Pawns::probe(pos, th->pawnsTable);
-  score += apply_weight(ei.pi->pawns_value(), Weights[PawnStructure]);
+  score += apply_weight(ei.pi->pawns_value(), weight<Custom>(PawnStructure));
+
+  // Lazy exit when the partial score is far enough outside the window. The
+  // guard keeps out the positions where the remaining terms can swing the
+  // score by more than LazyMargin: king attacks with queens and passed pawns,
+  // and endgames that the final scaling would pull towards a draw.
+  if (   !Trace
+      && !pos.pieces(QUEEN)
+      && !(ei.pi->passed_pawns(WHITE) | ei.pi->passed_pawns(BLACK))
+      &&  ei.mi->scale_factor(pos, WHITE) == SCALE_FACTOR_NORMAL
+      &&  ei.mi->scale_factor(pos, BLACK) == SCALE_FACTOR_NORMAL
+      && !(ei.mi->game_phase() < PHASE_MIDGAME && pos.opposite_bishops()))
+  {
+      Value v = interpolate(score, ei.mi->game_phase(), SCALE_FACTOR_NORMAL);
+
+      if (pos.side_to_move() == BLACK)
+          v = -v;
+
+      if (v - LazyMargin >= beta)
+          return v - LazyMargin;
+
+      if (v + LazyMargin <= alpha)
+          return v + LazyMargin;
+  }
 
   // Initialize attack and king safety bitboards
 	/*
@@ -427,7 +564,7 @@ Value do_evaluate(const Position& pos)
   score +=  evaluate_pieces_of_color<WHITE, Trace>(pos, ei, mobility)
           - evaluate_pieces_of_color<BLACK, Trace>(pos, ei, mobility);
 
-  score += apply_weight(mobility[WHITE] - mobility[BLACK], Weights[Mobility]);
+  score += apply_weight(mobility[WHITE] - mobility[BLACK], weight<Custom>(Mobility));
 
   // Evaluate kings after all other pieces because we need complete attack
   // information when computing the king safety evaluation.
@@ -439,8 +576,8 @@ Value do_evaluate(const Position& pos)
           - evaluate_threats<BLACK, Trace>(pos, ei);
 
   // Evaluate passed pawns, we need full attack information including king
-  score +=  evaluate_passed_pawns<WHITE, Trace>(pos, ei)
-          - evaluate_passed_pawns<BLACK, Trace>(pos, ei);
+  score +=  evaluate_passed_pawns<WHITE, Trace, Custom>(pos, ei)
+          - evaluate_passed_pawns<BLACK, Trace, Custom>(pos, ei);
 
   // If one side has only a king, score for potential unstoppable pawns
   if (!pos.non_pawn_material(WHITE) || !pos.non_pawn_material(BLACK))
@@ -451,7 +588,7 @@ Value do_evaluate(const Position& pos)
   if (ei.mi->space_weight())
   {
       int s = evaluate_space<WHITE>(pos, ei) - evaluate_space<BLACK>(pos, ei);
-      score += apply_weight(s * ei.mi->space_weight(), Weights[Space]);
+      score += apply_weight(s * ei.mi->space_weight(), weight<Custom>(Space));
   }
 
   // Scale winning side if position is more drawish that what it appears
@@ -604,7 +741,7 @@ Value do_evaluate(const Position& pos)
 	evaluate_pieces_of_color֐Ă΂Ă
 	*/
   template<PieceType Piece, Color Us, bool Trace>
-  Score evaluate_pieces(const Position& pos, EvalInfo& ei, Score* mobility, Bitboard mobilityArea) 
+  Score evaluate_pieces(const Position& pos, EvalInfo& ei, MobilityBatch& mobility, Bitboard mobilityArea) 
 	{
 
     Bitboard b;
@@ -657,13 +794,7 @@ Value do_evaluate(const Position& pos)
 				/*
 				nꂽev[g킪QUEENłȂȂHmobilityAreaƂ́H
 				*/
-        int mob = Piece != QUEEN ? popcount<Max15>(b & mobilityArea)
-                                 : popcount<Full >(b & mobilityArea);
-				/*
-				MobilityBonus[piece Type][]͋킲ƂɃ~h]lƃGh]lĂ
-				modȂɂ̂ȂvXȂ̂Ń{[iXH
-				*/
-        mobility[Us] += MobilityBonus[Piece][mob];
+        mobility.add(Piece, b & mobilityArea);
 
         // Decrease score if we are attacked by an enemy pawn. Remaining part
         // of threat evaluation must be done later when we have full attack info.
@@ -756,7 +887,12 @@ Value do_evaluate(const Position& pos)
 						/*
 						mobs
 						*/
-            if (mob > 3 || ei.pi->semiopen(Us, file_of(s)))
+            if (ei.pi->semiopen(Us, file_of(s)))
+                continue;
+
+            // Mobility itself is counted in batches, see MobilityBatch
+            int mob = popcount<Max15>(b & mobilityArea);
+            if (mob > 3)
                 continue;
 						/*
 						ROOKɑ΂vyieC
@@ -824,10 +960,14 @@ Value do_evaluate(const Position& pos)
 		*/
     const Bitboard mobilityArea = ~(ei.attackedBy[Them][PAWN] | pos.pieces(Us, PAWN, KING));
 
-    Score score =  evaluate_pieces<KNIGHT, Us, Trace>(pos, ei, mobility, mobilityArea)
-                 + evaluate_pieces<BISHOP, Us, Trace>(pos, ei, mobility, mobilityArea)
-                 + evaluate_pieces<ROOK,   Us, Trace>(pos, ei, mobility, mobilityArea)
-                 + evaluate_pieces<QUEEN,  Us, Trace>(pos, ei, mobility, mobilityArea);
+    MobilityBatch batch;
+
+    Score score =  evaluate_pieces<KNIGHT, Us, Trace>(pos, ei, batch, mobilityArea)
+                 + evaluate_pieces<BISHOP, Us, Trace>(pos, ei, batch, mobilityArea)
+                 + evaluate_pieces<ROOK,   Us, Trace>(pos, ei, batch, mobilityArea)
+                 + evaluate_pieces<QUEEN,  Us, Trace>(pos, ei, batch, mobilityArea);
+
+    mobility[Us] += batch.score();
 
     // Sum up all attacked squares (updated in evaluate_pieces)
     ei.attackedBy[Us][ALL_PIECES] =  ei.attackedBy[Us][PAWN]   | ei.attackedBy[Us][KNIGHT]
@@ -859,7 +999,7 @@ Value do_evaluate(const Position& pos)
 		/*
 		ԑKING̈S]lH
 		*/
-    Score score = ei.pi->king_safety<Us>(pos, ksq);
+    Score score = ei.pi->king_safety<Us>(pos, ksq, pos.this_thread()->kingSafetyStats);
 
     // Main king safety evaluation
 		/*
@@ -925,25 +1065,16 @@ Value do_evaluate(const Position& pos)
         b1 = pos.attacks_from<ROOK>(ksq) & safe;
         b2 = pos.attacks_from<BISHOP>(ksq) & safe;
 
-        // Enemy queen safe checks
-        b = (b1 | b2) & ei.attackedBy[Them][QUEEN];
-        if (b)
-            attackUnits += QueenCheck * popcount<Max15>(b);
-
-        // Enemy rooks safe checks
-        b = b1 & ei.attackedBy[Them][ROOK];
-        if (b)
-            attackUnits += RookCheck * popcount<Max15>(b);
+        // Enemy queen, rook, bishop and knight safe checks, counted together
+        Bitboard checks[4] = { (b1 | b2) & ei.attackedBy[Them][QUEEN],
+                               b1 & ei.attackedBy[Them][ROOK],
+                               b2 & ei.attackedBy[Them][BISHOP],
+                               pos.attacks_from<KNIGHT>(ksq) & ei.attackedBy[Them][KNIGHT] & safe };
+        int count[4];
+        popcount4(checks, count);
 
-        // Enemy bishops safe checks
-        b = b2 & ei.attackedBy[Them][BISHOP];
-        if (b)
-            attackUnits += BishopCheck * popcount<Max15>(b);
-
-        // Enemy knights safe checks
-        b = pos.attacks_from<KNIGHT>(ksq) & ei.attackedBy[Them][KNIGHT] & safe;
-        if (b)
-            attackUnits += KnightCheck * popcount<Max15>(b);
+        attackUnits +=  QueenCheck  * count[0] + RookCheck   * count[1]
+                      + BishopCheck * count[2] + KnightCheck * count[3];
 
         // To index KingDanger[] attackUnits must be in [0, 99] range
         attackUnits = std::min(99, std::max(0, attackUnits));
@@ -1006,7 +1137,7 @@ Value do_evaluate(const Position& pos)
 
   // evaluate_passed_pawns() evaluates the passed pawns of the given color
 
-  template<Color Us, bool Trace>
+  template<Color Us, bool Trace, bool Custom>
   Score evaluate_passed_pawns(const Position& pos, const EvalInfo& ei) 
 	{
 
@@ -1113,7 +1244,7 @@ Value do_evaluate(const Position& pos)
         Tracing::scores[Us][PASSED] = apply_weight(score, Weights[PassedPawns]);
 
     // Add the scores to the middle game and endgame eval
-    return apply_weight(score, Weights[PassedPawns]);
+    return apply_weight(score, weight<Custom>(PassedPawns));
   }
 
 
@@ -1250,7 +1381,7 @@ Value do_evaluate(const Position& pos)
     stream << std::showpoint << std::showpos << std::fixed << std::setprecision(2);
     std::memset(scores, 0, 2 * (TOTAL + 1) * sizeof(Score));
 
-    do_evaluate<true>(pos);
+    do_evaluate<true, true>(pos, -VALUE_INFINITE, VALUE_INFINITE);
 
     std::string totals = stream.str();
     stream.str("");
@@ -20,16 +20,50 @@
 #ifndef EVALUATE_H_INCLUDED
 #define EVALUATE_H_INCLUDED
 
+#include <vector>
+
 #include "types.h"
 
 class Position;
 
 namespace Eval {
 
+/// Eval::Cache is the per-thread evaluation cache. It is a hash table indexed
+/// by the position key, like the pawn and material tables, but its size is
+/// set at runtime by the "Eval Cache" UCI option (in MB, 0 disables it). As in
+/// the TT only the upper 32 bits of the key are stored; they are xored with
+/// the root color because king safety evaluation depends on it.
+
+struct CacheEntry {
+  uint32_t key32;
+  int32_t value;
+};
+
+class Cache {
+public:
+  Cache() : probes(0), hits(0), mask(0) {}
+  void resize(size_t mbSize);
+  void clear();
+  bool enabled() const { return !entries.empty(); }
+  CacheEntry* first_entry(Key k) { return &entries[(uint32_t)k & mask]; }
+
+  uint64_t probes, hits; // Statistics reported by bench
+
+private:
+  std::vector<CacheEntry> entries;
+  uint32_t mask;
+};
+
 extern void init();
-extern Value evaluate(const Position& pos);
+extern Value evaluate(const Position& pos, Value alpha, Value beta);
 extern std::string trace(const Position& pos);
 
+/// evaluate() with a full window always returns the exact evaluation
+
+inline Value evaluate(const Position& pos) {
+  return evaluate(pos, -VALUE_INFINITE, VALUE_INFINITE);
+}
+
 }
 
 #endif // #ifndef EVALUATE_H_INCLUDED
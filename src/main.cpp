@@ -76,10 +76,13 @@ int main(int argc, char* argv[]) {
   Bitboards::init();
   Position::init();
   Bitbases::init_kpk();
+  Endgames::init();
+  Material::init();
   Search::init();
   Pawns::init();
   Eval::init();
   Threads.init();
+  Output::init();
   TT.set_size(Options["Hash"]);
 
   std::string args;
@@ -93,6 +96,7 @@ int main(int argc, char* argv[]) {
 	UCI::loop(args);
 
   Threads.exit();
+  Output::exit();
 }
 
 //code݂ł͂킩Ȃ
@@ -84,41 +84,115 @@ namespace {
   Endgame<KPsK>   ScaleKPsK[]   = { Endgame<KPsK>(WHITE),   Endgame<KPsK>(BLACK) };
   Endgame<KPKP>   ScaleKPKP[]   = { Endgame<KPKP>(WHITE),   Endgame<KPKP>(BLACK) };
 
+  // Material configurations in the table: up to 8 pawns, 2 knights, 2 bishops,
+  // 2 rooks and 1 queen per side. The index is the mixed radix number made of
+  // the piece counts of both sides, see side_index().
+  const int SideSize  = 9 * 3 * 3 * 3 * 2;
+  const int TableSize = SideSize * SideSize;
+
+  Material::Entry Entries[TableSize];
+
+  // Counts is a material configuration given by its piece counts. It has the
+  // part of the Position interface used by compute(), so that the entries can
+  // be computed without setting up a position.
+  struct Counts {
+
+    Counts(const Position& pos) {
+
+      for (Color c = WHITE; c <= BLACK; ++c)
+      {
+          n[c][PAWN]   = pos.count<PAWN  >(c);
+          n[c][KNIGHT] = pos.count<KNIGHT>(c);
+          n[c][BISHOP] = pos.count<BISHOP>(c);
+          n[c][ROOK]   = pos.count<ROOK  >(c);
+          n[c][QUEEN]  = pos.count<QUEEN >(c);
+      }
+    }
+
+    explicit Counts(int idx) {
+
+      for (int c = BLACK; c >= WHITE; --c, idx /= SideSize)
+      {
+          int s = idx % SideSize;
+          n[c][QUEEN]  = s % 2; s /= 2;
+          n[c][ROOK]   = s % 3; s /= 3;
+          n[c][BISHOP] = s % 3; s /= 3;
+          n[c][KNIGHT] = s % 3; s /= 3;
+          n[c][PAWN]   = s;
+      }
+    }
+
+    template<PieceType Pt> int count(Color c) const { return n[c][Pt]; }
+    template<PieceType Pt> int count() const { return n[WHITE][Pt] + n[BLACK][Pt]; }
+
+    Value non_pawn_material(Color c) const {
+      return  n[c][KNIGHT] * KnightValueMg + n[c][BISHOP] * BishopValueMg
+            + n[c][ROOK]   * RookValueMg   + n[c][QUEEN]  * QueenValueMg;
+    }
+
+    Key key() const {
+
+      Key k = 0;
+
+      for (Color c = WHITE; c <= BLACK; ++c)
+          for (PieceType pt = PAWN; pt <= QUEEN; ++pt)
+              for (int cnt = 0; cnt < n[c][pt]; ++cnt)
+                  k ^= Zobrist::psq[c][pt][cnt];
+
+      return k;
+    }
+
+    int n[COLOR_NB][PIECE_TYPE_NB];
+  };
+
+  // side_index() returns the index of the pieces of the given color in the
+  // table, or -1 if there are more of them than the table has room for.
+  int side_index(const Position& pos, Color c) {
+
+    int knights = pos.count<KNIGHT>(c), bishops = pos.count<BISHOP>(c);
+    int rooks = pos.count<ROOK>(c), queens = pos.count<QUEEN>(c);
+
+    if (knights > 2 || bishops > 2 || rooks > 2 || queens > 1)
+        return -1;
+
+    return (((pos.count<PAWN>(c) * 3 + knights) * 3 + bishops) * 3 + rooks) * 2 + queens;
+  }
+
   // Helper templates used to detect a given material distribution
 	/*
 	GPAWN[łPAWN̕]l̑v[iKING͂jwPAWN]lRookValueMgȏ゠
 	܂葊KINĜ݂łKING+ROOKȂtrueԂ
 	is_KXK͂瑤King+x(ǂ̋Ƃ͕Ȃ̕]lWvRookValueMgȏ゠jǂ𔻒肵Ă
 	*/
-  template<Color Us> bool is_KXK(const Position& pos) 
+  template<Color Us> bool is_KXK(const Counts& mc) 
 	{
     const Color Them = (Us == WHITE ? BLACK : WHITE);
-    return  !pos.count<PAWN>(Them)
-          && pos.non_pawn_material(Them) == VALUE_ZERO
-          && pos.non_pawn_material(Us) >= RookValueMg;
+    return  !mc.count<PAWN>(Them)
+          && mc.non_pawn_material(Them) == VALUE_ZERO
+          && mc.non_pawn_material(Us) >= RookValueMg;
   }
 	/*
 	PAWN]lBishopValueMg傤ǁABISHOPPPAWNPȏ゠
 	is_KBPsKsKing+Bishop+Pawn VS King + ǂȋ邩Ȃ
 	*/
-  template<Color Us> bool is_KBPsKs(const Position& pos) 
+  template<Color Us> bool is_KBPsKs(const Counts& mc) 
 	{
-    return   pos.non_pawn_material(Us) == BishopValueMg
-          && pos.count<BISHOP>(Us) == 1
-          && pos.count<PAWN  >(Us) >= 1;
+    return   mc.non_pawn_material(Us) == BishopValueMg
+          && mc.count<BISHOP>(Us) == 1
+          && mc.count<PAWN  >(Us) >= 1;
   }
 	/*
 	瑤ɂPAWNȂ{QueenP@VS@KING+ROOKP{PAWN
 	ł邱Ƃ𔻒肵Ă
 	*/
-  template<Color Us> bool is_KQKRPs(const Position& pos) 
+  template<Color Us> bool is_KQKRPs(const Counts& mc) 
 	{
     const Color Them = (Us == WHITE ? BLACK : WHITE);
-    return  !pos.count<PAWN>(Us)
-          && pos.non_pawn_material(Us) == QueenValueMg
-          && pos.count<QUEEN>(Us)  == 1
-          && pos.count<ROOK>(Them) == 1
-          && pos.count<PAWN>(Them) >= 1;
+    return  !mc.count<PAWN>(Us)
+          && mc.non_pawn_material(Us) == QueenValueMg
+          && mc.count<QUEEN>(Us)  == 1
+          && mc.count<ROOK>(Them) == 1
+          && mc.count<PAWN>(Them) >= 1;
   }
 
   /// imbalance() calculates imbalance comparing piece count of each
@@ -151,41 +225,28 @@ namespace {
     return value;
   }
 
-} // namespace
-
-namespace Material {
-
-/// Material::probe() takes a position object as input, looks up a MaterialEntry
-/// object, and returns a pointer to it. If the material configuration is not
-/// already present in the table, it is computed and stored there, so we don't
-/// have to recompute everything when the same material configuration occurs again.
+  /// compute() fills the entry of a material configuration. It is used to
+  /// build the table and for the configurations outside it.
 /*
 xvẐMaterialEntryɕۑĂA΂Ԃ
 ȂΌvZĕۑB
 ȂɂvZĂH
 */
-Entry* probe(const Position& pos, Table& entries, Endgames& endgames) 
+void compute(Material::Entry* e, const Counts& mc)
 {
 
-  Key key = pos.material_key();
-  Entry* e = entries[key];
-
-  // If e->key matches the position's material hash key, it means that we
-  // have analysed this material configuration before, and we can simply
-  // return the information we found the last time instead of recomputing it.
-  if (e->key == key)
-      return e;
+  Key key = mc.key();
 	/*
 	material_keyindeẍ[NA
 	probe֐EntryNX\zĂH
 	*/
-  std::memset(e, 0, sizeof(Entry));
+  std::memset(e, 0, sizeof(Material::Entry));
   e->key = key;
   e->factor[WHITE] = e->factor[BLACK] = (uint8_t)SCALE_FACTOR_NORMAL;
 	/*
 	game_phasePAWNȊŐ]l𐳋KĕԂi0-128)
 	*/
-  e->gamePhase = game_phase(pos);
+  e->gamePhase = Material::game_phase(mc.non_pawn_material(WHITE) + mc.non_pawn_material(BLACK));
 
   // Let's look if we have a specialized evaluation function for this
   // particular material configuration. First we look for a fixed
@@ -193,37 +254,35 @@ Entry* probe(const Position& pos, Table& entries, Endgames& endgames)
 	/*
 	endgameɊ֌W肻Ȃ̂ŃpX
 	*/
-  if (endgames.probe(key, &e->evaluationFunction))
-      return e;
+  if (Endgames::probe(key, &e->evaluationFunction))
+      return;
 	/*
 	ՂɎcĂWHITEKXKłΊ֐ݒ肵ċA
 	*/
-  if (is_KXK<WHITE>(pos))
+  if (is_KXK<WHITE>(mc))
   {
       e->evaluationFunction = &EvaluateKXK[WHITE];
-      return e;
+      return;
   }
 	/*
 	ՂɎcĂBLACKKXKłΊ֐ݒ肵ċA
 	*/
-	if (is_KXK<BLACK>(pos))
+	if (is_KXK<BLACK>(mc))
   {
       e->evaluationFunction = &EvaluateKXK[BLACK];
-      return e;
+      return;
   }
 
-  if (!pos.pieces(PAWN) && !pos.pieces(ROOK) && !pos.pieces(QUEEN))
+  if (!mc.count<PAWN>() && !mc.count<ROOK>() && !mc.count<QUEEN>())
   {
-      // Minor piece endgame with at least one minor piece per side and
-      // no pawns. Note that the case KmmK is already handled by KXK.
-      assert((pos.pieces(WHITE, KNIGHT) | pos.pieces(WHITE, BISHOP)));
-      assert((pos.pieces(BLACK, KNIGHT) | pos.pieces(BLACK, BISHOP)));
+      // Minor piece endgame with no pawns. Note that the case KmmK is already
+      // handled by KXK, and KmK and KK are detected as draws by the search.
 
-      if (   pos.count<BISHOP>(WHITE) + pos.count<KNIGHT>(WHITE) <= 2
-          && pos.count<BISHOP>(BLACK) + pos.count<KNIGHT>(BLACK) <= 2)
+      if (   mc.count<BISHOP>(WHITE) + mc.count<KNIGHT>(WHITE) <= 2
+          && mc.count<BISHOP>(BLACK) + mc.count<KNIGHT>(BLACK) <= 2)
       {
-          e->evaluationFunction = &EvaluateKmmKm[pos.side_to_move()];
-          return e;
+          e->evaluationFunction = &EvaluateKmmKm[WHITE]; // A draw for both colors
+          return;
       }
   }
 
@@ -234,43 +293,43 @@ Entry* probe(const Position& pos, Table& entries, Endgames& endgames)
   // scaling functions and we need to decide which one to use.
   EndgameBase<ScaleFactor>* sf;
 
-  if (endgames.probe(key, &sf))
+  if (Endgames::probe(key, &sf))
   {
       e->scalingFunction[sf->color()] = sf;
-      return e;
+      return;
   }
 
   // Generic scaling functions that refer to more then one material
   // distribution. Should be probed after the specialized ones.
   // Note that these ones don't return after setting the function.
-  if (is_KBPsKs<WHITE>(pos))
+  if (is_KBPsKs<WHITE>(mc))
       e->scalingFunction[WHITE] = &ScaleKBPsK[WHITE];
 
-  if (is_KBPsKs<BLACK>(pos))
+  if (is_KBPsKs<BLACK>(mc))
       e->scalingFunction[BLACK] = &ScaleKBPsK[BLACK];
 
-  if (is_KQKRPs<WHITE>(pos))
+  if (is_KQKRPs<WHITE>(mc))
       e->scalingFunction[WHITE] = &ScaleKQKRPs[WHITE];
 
-  else if (is_KQKRPs<BLACK>(pos))
+  else if (is_KQKRPs<BLACK>(mc))
       e->scalingFunction[BLACK] = &ScaleKQKRPs[BLACK];
 
-  Value npm_w = pos.non_pawn_material(WHITE);
-  Value npm_b = pos.non_pawn_material(BLACK);
+  Value npm_w = mc.non_pawn_material(WHITE);
+  Value npm_b = mc.non_pawn_material(BLACK);
 
   if (npm_w + npm_b == VALUE_ZERO)
   {
-      if (!pos.count<PAWN>(BLACK))
+      if (!mc.count<PAWN>(BLACK))
       {
-          assert(pos.count<PAWN>(WHITE) >= 2);
+          assert(mc.count<PAWN>(WHITE) >= 2);
           e->scalingFunction[WHITE] = &ScaleKPsK[WHITE];
       }
-      else if (!pos.count<PAWN>(WHITE))
+      else if (!mc.count<PAWN>(WHITE))
       {
-          assert(pos.count<PAWN>(BLACK) >= 2);
+          assert(mc.count<PAWN>(BLACK) >= 2);
           e->scalingFunction[BLACK] = &ScaleKPsK[BLACK];
       }
-      else if (pos.count<PAWN>(WHITE) == 1 && pos.count<PAWN>(BLACK) == 1)
+      else if (mc.count<PAWN>(WHITE) == 1 && mc.count<PAWN>(BLACK) == 1)
       {
           // This is a special case because we set scaling functions
           // for both colors instead of only one.
@@ -281,23 +340,23 @@ Entry* probe(const Position& pos, Table& entries, Endgames& endgames)
 
   // No pawns makes it difficult to win, even with a material advantage. This
   // catches some trivial draws like KK, KBK and KNK
-  if (!pos.count<PAWN>(WHITE) && npm_w - npm_b <= BishopValueMg)
+  if (!mc.count<PAWN>(WHITE) && npm_w - npm_b <= BishopValueMg)
   {
       e->factor[WHITE] = (uint8_t)
-      (npm_w == npm_b || npm_w < RookValueMg ? 0 : NoPawnsSF[std::min(pos.count<BISHOP>(WHITE), 2)]);
+      (npm_w == npm_b || npm_w < RookValueMg ? 0 : NoPawnsSF[std::min(mc.count<BISHOP>(WHITE), 2)]);
   }
 
-  if (!pos.count<PAWN>(BLACK) && npm_b - npm_w <= BishopValueMg)
+  if (!mc.count<PAWN>(BLACK) && npm_b - npm_w <= BishopValueMg)
   {
       e->factor[BLACK] = (uint8_t)
-      (npm_w == npm_b || npm_b < RookValueMg ? 0 : NoPawnsSF[std::min(pos.count<BISHOP>(BLACK), 2)]);
+      (npm_w == npm_b || npm_b < RookValueMg ? 0 : NoPawnsSF[std::min(mc.count<BISHOP>(BLACK), 2)]);
   }
 
   // Compute the space weight
   if (npm_w + npm_b >= 2 * QueenValueMg + 4 * RookValueMg + 2 * KnightValueMg)
   {
-      int minorPieceCount =  pos.count<KNIGHT>(WHITE) + pos.count<BISHOP>(WHITE)
-                           + pos.count<KNIGHT>(BLACK) + pos.count<BISHOP>(BLACK);
+      int minorPieceCount =  mc.count<KNIGHT>(WHITE) + mc.count<BISHOP>(WHITE)
+                           + mc.count<KNIGHT>(BLACK) + mc.count<BISHOP>(BLACK);
 
       e->spaceWeight = make_score(minorPieceCount * minorPieceCount, 0);
   }
@@ -306,28 +365,69 @@ Entry* probe(const Position& pos, Table& entries, Endgames& endgames)
   // for the bishop pair "extended piece", this allow us to be more flexible
   // in defining bishop pair bonuses.
   const int pieceCount[COLOR_NB][PIECE_TYPE_NB] = {
-  { pos.count<BISHOP>(WHITE) > 1, pos.count<PAWN>(WHITE), pos.count<KNIGHT>(WHITE),
-    pos.count<BISHOP>(WHITE)    , pos.count<ROOK>(WHITE), pos.count<QUEEN >(WHITE) },
-  { pos.count<BISHOP>(BLACK) > 1, pos.count<PAWN>(BLACK), pos.count<KNIGHT>(BLACK),
-    pos.count<BISHOP>(BLACK)    , pos.count<ROOK>(BLACK), pos.count<QUEEN >(BLACK) } };
+  { mc.count<BISHOP>(WHITE) > 1, mc.count<PAWN>(WHITE), mc.count<KNIGHT>(WHITE),
+    mc.count<BISHOP>(WHITE)    , mc.count<ROOK>(WHITE), mc.count<QUEEN >(WHITE) },
+  { mc.count<BISHOP>(BLACK) > 1, mc.count<PAWN>(BLACK), mc.count<KNIGHT>(BLACK),
+    mc.count<BISHOP>(BLACK)    , mc.count<ROOK>(BLACK), mc.count<QUEEN >(BLACK) } };
 
   e->value = (int16_t)((imbalance<WHITE>(pieceCount) - imbalance<BLACK>(pieceCount)) / 16);
+}
+
+} // namespace
+
+namespace Material {
+
+/// Material::init() computes the entries of all the material configurations
+/// in the table, so it must be called after Endgames::init(). The table is
+/// shared by all the threads and never written after init(), so it needs no
+/// locking.
+
+void init()
+{
+
+  for (int idx = 0; idx < TableSize; ++idx)
+      compute(&Entries[idx], Counts(idx));
+}
+
+
+/// Material::probe() takes a position object as input and returns a pointer to
+/// the entry of its material configuration. Entries are found in the table by
+/// direct indexing with the piece counts, so there is no hashing and no miss.
+/// The configurations outside the table, only reachable by promotions (e.g.
+/// a second queen), are cached in the small per-thread 'spares' hash table.
+
+Entry* probe(const Position& pos, Table& spares)
+{
+
+  int w = side_index(pos, WHITE), b = side_index(pos, BLACK);
+
+  if (w >= 0 && b >= 0)
+  {
+      assert(Entries[w * SideSize + b].key == pos.material_key());
+
+      return &Entries[w * SideSize + b];
+  }
+
+  Key key = pos.material_key();
+  Entry* e = spares[key];
+
+  if (e->key != key)
+      compute(e, Counts(pos));
+
+  assert(e->key == key);
+
   return e;
 }
 
 
-/// Material::game_phase() calculates the phase given the current
-/// position. Because the phase is strictly a function of the material, it
-/// is stored in MaterialEntry.
+/// Material::game_phase() calculates the phase given the non-pawn material
+/// of both sides. Because the phase is strictly a function of the material,
+/// it is stored in MaterialEntry.
 /*
 ]l̐KlԂ(0-128)
 */
-Phase game_phase(const Position& pos) 
+Phase game_phase(Value npm)
 {
-	/*
-	npmɂ͂ꂼ̃J[PAWN]l𑫂킹
-	*/
-  Value npm = pos.non_pawn_material(WHITE) + pos.non_pawn_material(BLACK);
 	/*
 	npmMidgameLimit(15,581)𒴂悤łPHASE_MIDGAME(=128)Ԃ
 	npmEndgameLimit(3,998)悤łPHASE_ENDGAME(0jԂ
@@ -58,10 +58,15 @@ struct Entry {
   Phase gamePhase;
 };
 
-typedef HashTable<Entry, 8192> Table;
+typedef HashTable<Entry, 256> Table; // Configurations outside the shared table
 
-Entry* probe(const Position& pos, Table& entries, Endgames& endgames);
-Phase game_phase(const Position& pos);
+void init();
+Entry* probe(const Position& pos, Table& spares);
+Phase game_phase(Value npm);
+
+inline Phase game_phase(const Position& pos) {
+  return game_phase(pos.non_pawn_material(WHITE) + pos.non_pawn_material(BLACK));
+}
 
 /// Material::scale_factor takes a position and a color as input, and
 /// returns a scale factor for the given color. We have to provide the
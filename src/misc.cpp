@@ -17,10 +17,15 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 #include "misc.h"
 #include "thread.h"
@@ -98,34 +103,258 @@ void dbg_print()
 }
 
 
+/// The background logger. Records are copied, with a binary time stamp, in a
+/// bounded ring buffer and a dedicated thread formats and writes them out, so
+/// a logging thread only pays for a memcpy under a short lock and never waits
+/// on the disk. When the ring is full new records are dropped and counted
+/// rather than blocking. A file that grows over the rotation size is renamed
+/// to <name>.1, shifting the older ones up to <name>.<LogBackups>.
+
+namespace {
+
+  const size_t LogRingSize = 1 << 20;
+  const int LogBackups = 3;
+
+  struct LogHeader {
+    int64_t time; // Microseconds since the epoch
+    uint32_t len;
+    uint32_t sink;
+  };
+
+  class AsyncLog {
+
+    AsyncLog() : ring(LogRingSize), head(0), tail(0), dropped(0),
+                 maxSize(16 << 20), exiting(false) {
+      writer = std::thread(&AsyncLog::idle_loop, this);
+    }
+
+  public:
+    static AsyncLog& instance() { static AsyncLog l; return l; }
+
+   ~AsyncLog() {
+      {
+          std::unique_lock<std::mutex> lk(mutex);
+          exiting = true;
+      }
+      sleepCondition.notify_one();
+      writer.join();
+    }
+
+    void push(const string& file, const char* text, size_t len);
+    void set_rotation(size_t bytes) { maxSize = bytes; }
+
+  private:
+    void copy_in(const void* src, size_t n);
+    void idle_loop();
+    void write(size_t sink, int64_t time, const char* text, size_t len);
+
+    vector<char> ring;
+    size_t head, tail; // Monotonic byte counters, the ring index is modulo size
+    size_t dropped;
+    std::atomic<size_t> maxSize;
+    bool exiting;
+    vector<string> sinks;
+    std::mutex mutex;
+    std::condition_variable sleepCondition;
+    std::thread writer;
+
+    // Only accessed by the writer thread
+    vector<ofstream*> files;
+    vector<uint64_t> sizes;
+  };
+
+  void AsyncLog::copy_in(const void* src, size_t n) {
+
+    size_t idx = head % LogRingSize, first = std::min(n, LogRingSize - idx);
+
+    memcpy(&ring[idx], src, first);
+    memcpy(&ring[0], (const char*)src + first, n - first);
+    head += n;
+  }
+
+  void AsyncLog::push(const string& file, const char* text, size_t len) {
+
+    LogHeader h;
+    h.time = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+    h.len = uint32_t(len);
+
+    std::unique_lock<std::mutex> lk(mutex);
+
+    if (head - tail + sizeof(LogHeader) + len > LogRingSize)
+    {
+        ++dropped;
+        return;
+    }
+
+    h.sink = uint32_t(std::find(sinks.begin(), sinks.end(), file) - sinks.begin());
+
+    if (h.sink == sinks.size())
+        sinks.push_back(file);
+
+    copy_in(&h, sizeof(LogHeader));
+    copy_in(text, len);
+
+    bool wake = head - tail > LogRingSize / 2;
+    lk.unlock();
+
+    if (wake)
+        sleepCondition.notify_one();
+  }
+
+  void AsyncLog::write(size_t sink, int64_t time, const char* text, size_t len) {
+
+    while (files.size() <= sink)
+    {
+        files.push_back(NULL);
+        sizes.push_back(0);
+    }
+
+    std::unique_lock<std::mutex> lk(mutex);
+    string name = sinks[sink];
+    lk.unlock();
+
+    if (files[sink] && sizes[sink] >= maxSize)
+    {
+        delete files[sink];
+        files[sink] = NULL;
+
+        for (int i = LogBackups; i > 0; --i)
+            rename((i > 1 ? name + "." + to_string(i - 1) : name).c_str(),
+                   (name + "." + to_string(i)).c_str());
+    }
+
+    if (!files[sink])
+    {
+        files[sink] = new ofstream(name.c_str(), ios::out | ios::app);
+        files[sink]->seekp(0, ios::end);
+        sizes[sink] = uint64_t(std::max(streamoff(0), streamoff(files[sink]->tellp())));
+    }
+
+    // Every line of the record gets the time stamp, as seconds.microseconds
+    char stamp[32];
+    int n = snprintf(stamp, sizeof(stamp), "%lld.%06d ", (long long)(time / 1000000), int(time % 1000000));
+
+    for (size_t b = 0, e; b < len; b = e + 1)
+    {
+        e = std::find(text + b, text + len, '\n') - text;
+
+        if (e == b && e + 1 >= len) // Trailing newline
+            break;
+
+        files[sink]->write(stamp, n).write(text + b, e - b).put('\n');
+        sizes[sink] += n + e - b + 1;
+    }
+  }
+
+  void AsyncLog::idle_loop() {
+
+    vector<char> chunk;
+
+    while (true)
+    {
+        std::unique_lock<std::mutex> lk(mutex);
+
+        if (head == tail && !dropped)
+        {
+            if (exiting)
+                break;
+
+            sleepCondition.wait_for(lk, milliseconds(200));
+        }
+
+        // Copy out what is pending and release the producers
+        size_t n = head - tail, idx = tail % LogRingSize, first = std::min(n, LogRingSize - idx);
+        size_t lost = dropped;
+
+        chunk.resize(n);
+        if (n)
+        {
+            memcpy(&chunk[0], &ring[idx], first);
+            memcpy(&chunk[first], &ring[0], n - first);
+        }
+        tail = head;
+        dropped = 0;
+        lk.unlock();
+
+        for (size_t p = 0; p < n; )
+        {
+            LogHeader h;
+            memcpy(&h, &chunk[p], sizeof(LogHeader));
+            write(h.sink, h.time, &chunk[p + sizeof(LogHeader)], h.len);
+            p += sizeof(LogHeader) + h.len;
+        }
+
+        if (lost)
+            for (size_t s = 0; s < files.size(); ++s)
+                if (files[s])
+                {
+                    string msg = "Dropped " + to_string(lost) + " log records";
+                    write(s, duration_cast<microseconds>(system_clock::now().time_since_epoch()).count(),
+                          msg.c_str(), msg.size());
+                }
+
+        for (ofstream* f : files)
+            if (f)
+                f->flush();
+    }
+
+    for (ofstream* f : files)
+        delete f;
+  }
+
+} // namespace
+
+
+/// log_write() queues a record for the given file, it never blocks on I/O
+
+void log_write(const string& file, const string& text) {
+  AsyncLog::instance().push(file, text.data(), text.size());
+}
+
+
+/// set_log_rotation() sets the size, in bytes, over which a log file is rotated
+
+void set_log_rotation(size_t bytes) { AsyncLog::instance().set_rotation(bytes); }
+
+
 /// Our fancy logging facility. The trick here is to replace cin.rdbuf() and
-/// cout.rdbuf() with two Tie objects that tie cin and cout to a file stream. We
-/// can toggle the logging of std::cout and std:cin at runtime while preserving
-/// usual i/o functionality and without changing a single line of code!
+/// cout.rdbuf() with two Tie objects that tie cin and cout to the background
+/// logger. We can toggle the logging of std::cout and std:cin at runtime while
+/// preserving usual i/o functionality and without changing a single line of code!
 /// Idea from http://groups.google.com/group/comp.lang.c++/msg/1d941c0f26ea0d81
 /*
 prs
 */
 struct Tie: public streambuf { // MSVC requires splitted streambuf for cin and cout
 
-  Tie(streambuf* b, ofstream* f) : buf(b), file(f) {}
+  Tie(streambuf* b, const char* p) : buf(b), prefix(p), line(p) {}
 
-  int sync() { return file->rdbuf()->pubsync(), buf->pubsync(); }
-  int overflow(int c) { return log(buf->sputc((char)c), "<< "); }
+  int sync() { return buf->pubsync(); }
+  int overflow(int c) { return log(buf->sputc((char)c)); }
   int underflow() { return buf->sgetc(); }
-  int uflow() { return log(buf->sbumpc(), ">> "); }
+  int uflow() { return log(buf->sbumpc()); }
 
   streambuf* buf;
-  ofstream* file;
+  const char* prefix;
+  string line;
 
-  int log(int c, const char* prefix) {
+  // Lines are collected in memory and queued whole. The two Ties are used by
+  // different threads (the UCI loop and the output writer), so each one keeps
+  // its own line.
+  int log(int c) {
 
-    static int last = '\n';
+    if (c == EOF)
+        return c;
 
-    if (last == '\n')
-        file->rdbuf()->sputn(prefix, 3);
+    if (c == '\n')
+    {
+        log_write("io_log.txt", line);
+        line = prefix;
+    }
+    else
+        line += (char)c;
 
-    return last = file->rdbuf()->sputc((char)c);
+    return c;
   }
 };
 /*
@@ -134,11 +363,13 @@ struct Tie: public streambuf { // MSVC requires splitted streambuf for cin and c
 class Logger 
 {
 
-  Logger() : in(cin.rdbuf(), &file), out(cout.rdbuf(), &file) {}
+  Logger() : in(cin.rdbuf(), ">> "), out(cout.rdbuf(), "<< "), active(false) {
+    AsyncLog::instance(); // Constructed first, so it is destroyed last
+  }
  ~Logger() { start(false); }
 
-  ofstream file;
   Tie in, out;
+  bool active;
 
 public:
   static void start(bool b) 
@@ -146,37 +377,159 @@ public:
 
     static Logger l;
 
-    if (b && !l.file.is_open())
+    if (b && !l.active)
     {
-        l.file.open("io_log.txt", ifstream::out | ifstream::app);
         cin.rdbuf(&l.in);
         cout.rdbuf(&l.out);
+        l.active = true;
     }
-    else if (!b && l.file.is_open())
+    else if (!b && l.active)
     {
         cout.rdbuf(l.out.buf);
         cin.rdbuf(l.in.buf);
-        l.file.close();
+        l.active = false;
     }
   }
 };
 
 
-/// Used to serialize access to std::cout to avoid multiple threads to write at
-/// the same time.
+/// The output queue is an intrusive multi-producer single-consumer list (after
+/// D. Vyukov): producers only exchange the head pointer, the writer thread
+/// pops from the tail. The writer sleeps on a condition variable when the queue
+/// is empty; producers signal it without taking the mutex, and the wait has a
+/// timeout so that a wake up lost in that race costs at most a few ms.
 
-std::ostream& operator<<(std::ostream& os, SyncCout sc) 
-{
+namespace {
+
+  struct OutputNode {
+    std::atomic<OutputNode*> next;
+    string text;
+  };
+
+  OutputNode Stub;
+  std::atomic<OutputNode*> Head(&Stub);
+  OutputNode* Tail = &Stub;
+  std::atomic<uint64_t> Pushed(0), Written(0);
+  std::atomic<bool> Running(false), Exiting(false);
+  std::mutex WriterMutex;
+  std::condition_variable WriterCondition;
+  std::thread Writer;
+
+  // Returns the oldest queued line, false if the queue is (or looks) empty
+  bool pop(string& text) {
+
+    OutputNode* tail = Tail;
+    OutputNode* next = tail->next.load(std::memory_order_acquire);
+
+    if (!next)
+        return false;
+
+    Tail = next; // 'next' becomes the new stub
+    text.swap(next->text);
+
+    if (tail != &Stub)
+        delete tail;
+
+    return true;
+  }
+
+  bool transient(const string& s) {
+    return s.compare(0, 5, "info ") == 0 && s.find(" currmove ") != string::npos;
+  }
+
+  void writer_loop() {
 
-  static std::mutex m;
+    vector<string> batch;
+    string text;
 
-  if (sc == io_lock)
-      m.lock();
+    while (true)
+    {
+        while (pop(text))
+            batch.push_back(std::move(text));
+
+        if (batch.empty())
+        {
+            if (Exiting && Written == Pushed)
+                break;
+
+            std::unique_lock<std::mutex> lk(WriterMutex);
+            WriterCondition.wait_for(lk, milliseconds(5));
+            continue;
+        }
+
+        // Only the newest transient line of the batch is worth writing
+        size_t last = batch.size();
+        for (size_t i = 0; i < batch.size(); ++i)
+            if (transient(batch[i]))
+                last = i;
+
+        for (size_t i = 0; i < batch.size(); ++i)
+            if (i == last || !transient(batch[i]))
+                cout << batch[i];
+
+        cout.flush();
+        Written += batch.size();
+        batch.clear();
+    }
+  }
+
+} // namespace
+
+
+/// Output::init() starts the writer thread. Until then, and after exit(), lines
+/// are written synchronously by the calling thread.
+
+void Output::init() {
+
+  Exiting = false;
+  Running = true;
+  Writer = std::thread(writer_loop);
+}
+
+
+/// Output::exit() writes what is still queued and joins the writer thread
+
+void Output::exit() {
+
+  Exiting = true;
+  WriterCondition.notify_one();
+  Writer.join();
+  Running = false;
+}
+
+
+/// Output::flush() waits until all the lines queued so far have been written.
+/// Used by commands that mix queued output with direct writes to a stream.
+
+void Output::flush() {
+
+  uint64_t target = Pushed;
+
+  while (Running && Written < target)
+      std::this_thread::sleep_for(milliseconds(1));
+}
+
+
+/// Output::push() queues a line, it never blocks
+
+void Output::push(const string& text) {
+
+  if (!Running)
+  {
+      static std::mutex m;
+      std::unique_lock<std::mutex> lk(m);
+      cout << text << std::flush;
+      return;
+  }
 
-  if (sc == io_unlock)
-      m.unlock();
+  OutputNode* n = new OutputNode;
+  n->next.store(NULL, std::memory_order_relaxed);
+  n->text = text;
 
-  return os;
+  ++Pushed;
+  OutputNode* prev = Head.exchange(n, std::memory_order_acq_rel);
+  prev->next.store(n, std::memory_order_release);
+  WriterCondition.notify_one();
 }
 
 
@@ -222,7 +575,7 @@ void prefetch(char* addr)
 void print_array(Square arr[], int size)
 {
 	for (int i = 0; i < size; i++){
-		cout << setw(2) << arr[i] << " ";
+		cout << setw(2) << int(arr[i]) << " ";
 		if (((i + 1) % 8) == 0) cout << endl;
 	}
 }
@@ -20,7 +20,11 @@
 #ifndef MISC_H_INCLUDED
 #define MISC_H_INCLUDED
 
+#include <algorithm>
+#include <cstdlib>
 #include <fstream>
+#include <iostream>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -55,12 +59,17 @@ extern void dbg_print();
 ǉ
 */
 extern void print_array(Square arr[], int size);
-/*
-MO@\Aݐp̃t@CXg[p
-*/
-struct Log : public std::ofstream {
-  Log(const std::string& f = "log.txt") : std::ofstream(f, std::ios::out | std::ios::app) {}
- ~Log() { if (is_open()) close(); }
+/// Log collects a record for the given file in memory. When it goes out of
+/// scope the record is handed to the background logger, see log_write(), so
+/// the caller never waits on the file system.
+
+extern void log_write(const std::string& file, const std::string& text);
+extern void set_log_rotation(size_t bytes);
+
+struct Log : public std::ostringstream {
+  Log(const std::string& f = "log.txt") : file(f) {}
+ ~Log() { log_write(file, str()); }
+  std::string file;
 };
 /*
 */
@@ -70,28 +79,117 @@ namespace Time {
 }
 
 
+/// HashTable is the per-thread table used for pawn and material entries. It
+/// starts with 'Size' entries and can be resized at runtime to a power of two
+/// number of entries; as for the TT the storage is aligned to a cache line.
+/// With two ways a key may be in either slot of an aligned pair: a hit in the
+/// second slot swaps the pair so the most recent entry comes first, while on
+/// a miss the first entry moves to the second slot and the first slot is
+/// returned to be overwritten. Entry must be a POD with a 'key' member.
+
 template<class Entry, int Size>
-struct HashTable {
-  HashTable() : e(Size, Entry()) {}
-  Entry* operator[](Key k) { return &e[(uint32_t)k & (Size - 1)]; }
+class HashTable {
+
+  HashTable(const HashTable&); // Non copyable
+  HashTable& operator=(const HashTable&);
+
+public:
+  HashTable() : probes(0), hits(0), mem(NULL), table(NULL), hashMask(0), ways(0) { resize(Size, 1); }
+ ~HashTable() { free(mem); }
+
+  static size_t default_kb() { return Size * sizeof(Entry) >> 10; }
+
+  void resize_kb(size_t kbSize, int w) {
+
+    size_t n = w;
+    while (2 * n * sizeof(Entry) <= (kbSize << 10))
+        n *= 2;
+
+    resize(n, w);
+  }
+
+  size_t size() const { return hashMask + ways; }
+
+  Entry* operator[](Key k) {
+
+    Entry* e = table + ((uint32_t)k & hashMask);
+
+    ++probes;
+
+    if (e->key == k)
+    {
+        ++hits;
+        return e;
+    }
+
+    if (ways == 2)
+    {
+        if (e[1].key == k)
+        {
+            ++hits;
+            std::swap(e[0], e[1]);
+        }
+        else
+            e[1] = e[0];
+    }
+    return e;
+  }
+
+  uint64_t probes, hits; // Statistics reported by bench
 
 private:
-  std::vector<Entry> e;
+  void resize(size_t n, int w) {
+
+    if (n == size() && w == ways)
+        return;
+
+    free(mem);
+    mem = calloc(n * sizeof(Entry) + CACHE_LINE_SIZE - 1, 1);
+
+    if (!mem)
+    {
+        std::cerr << "Failed to allocate " << (n * sizeof(Entry) >> 10)
+                  << "KB for hash table." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    table = (Entry*)((uintptr_t(mem) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1));
+    hashMask = uint32_t(n - w);
+    ways = w;
+    probes = hits = 0;
+  }
+
+  void* mem;
+  Entry* table;
+  uint32_t hashMask;
+  int ways;
 };
 
-/*
-sync_cout,sync_endlŏo͂ȂǂŎg
-̒TXbhɕWo͂ƕ\߂ႭɂȂ̂hłB
-sync_coutŃ~[eNXgpăbN
-sync_endlŃbN
-misc.cpp
-std::ostream& operator<<(std::ostream& os, SyncCout sc)
-ZqI[o[ChĂ΂
-*/
+/// Output lines to the GUI are not written by the thread that builds them:
+/// sync_cout starts a SyncLine that collects the text, and the line is handed
+/// whole to a lock-free queue when the statement ends. A dedicated writer
+/// thread drains the queue, so a GUI that reads the pipe slowly never blocks
+/// the search. Transient "info ... currmove" lines still queued when a newer
+/// one arrives are coalesced, only the newest is written.
+
+namespace Output {
+  void init();
+  void exit();
+  void flush();
+  void push(const std::string& text);
+}
+
+class SyncLine {
+public:
+ ~SyncLine() { Output::push(ss.str()); }
+  template<typename T> SyncLine& operator<<(const T& v) { ss << v; return *this; }
+  SyncLine& operator<<(std::ostream& (*f)(std::ostream&)) { ss << f; return *this; }
+
+private:
+  std::ostringstream ss;
+};
 
-enum SyncCout { io_lock, io_unlock };
-std::ostream& operator<<(std::ostream&, SyncCout);
-#define sync_cout std::cout << io_lock
-#define sync_endl std::endl << io_unlock
+#define sync_cout SyncLine()
+#define sync_endl std::endl
 
 #endif // #ifndef MISC_H_INCLUDED
@@ -337,7 +337,9 @@ void MovePicker::score<EVASIONS>()
   // is not under attack, ordered by history value, then bad-captures and quiet
   // moves with a negative SEE. This last group is ordered by the SEE score.
   Move m;
-  int seeScore;
+  int seeScore, seeSigns[MAX_MOVES];
+
+  pos.see_signs(moves, end, seeSigns);
 
   for (ExtMove* it = moves; it != end; ++it)
   {
@@ -349,7 +351,7 @@ void MovePicker::score<EVASIONS>()
 			2000_͂グ邽߂̂́H
 			ȏQވȊOȂhistoryz̒l̗p
 			*/
-      if ((seeScore = pos.see_sign(m)) < 0)
+      if ((seeScore = seeSigns[it - moves]) < 0)
           it->score = seeScore - HistoryStats::Max; // At the bottom
 
       else if (pos.capture(m))
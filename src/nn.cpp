@@ -0,0 +1,251 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2013 Marco Costalba, Joona Kiiski, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "bitboard.h"
+#include "nn.h"
+#include "position.h"
+#include "rkiss.h"
+
+#if defined(USE_AVX2)
+#  include <immintrin.h>
+#elif defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
+
+using namespace NN;
+
+namespace {
+
+  // Weights file layout, all little endian: the 4 byte magic, then int16
+  // FeatureWeights[Inputs][Half], int16 FeatureBias[Half], int16
+  // OutputWeights[2 * Half] (side to move half first) and int32 OutputBias.
+  const char Magic[4] = { 'S', 'F', 'N', '1' };
+
+  // Output is divided by this to get a Value
+  const int OutputScale = 64;
+
+  struct Network {
+    int16_t featureWeights[Inputs][Half];
+    int16_t featureBias[Half];
+    int16_t outputWeights[2 * Half];
+    int32_t outputBias;
+  };
+
+  Network Net;
+  bool Loaded, Placeholder;
+
+  // Input index of the piece as seen from 'view'. Black sees the board
+  // flipped, with its own pieces first, so both halves share the weights.
+  inline int feature(Color view, Color c, PieceType pt, Square s) {
+    return ((c != view) * 6 + pt - 1) * 64 + (view == WHITE ? s : ~s);
+  }
+
+  void refresh(const Position& pos, Accumulator& acc) {
+
+    for (Color view = WHITE; view <= BLACK; ++view)
+        std::memcpy(acc.v[view], Net.featureBias, sizeof(Net.featureBias));
+
+    for (Color c = WHITE; c <= BLACK; ++c)
+        for (PieceType pt = PAWN; pt <= KING; ++pt)
+        {
+            Bitboard b = pos.pieces(c, pt);
+            while (b)
+                NN::add(acc, c, pt, pop_lsb(&b));
+        }
+
+    acc.key = pos.key();
+  }
+
+  // Dot product of the clipped accumulator half with 'w'
+  int32_t affine(const int16_t* a, const int16_t* w) {
+
+#if defined(USE_AVX2)
+
+    const __m256i zero = _mm256_setzero_si256(), max = _mm256_set1_epi16(127);
+    __m256i sum = _mm256_setzero_si256();
+
+    for (int i = 0; i < Half; i += 16)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+        x = _mm256_min_epi16(_mm256_max_epi16(x, zero), max);
+        sum = _mm256_add_epi32(sum, _mm256_madd_epi16(x, _mm256_loadu_si256((const __m256i*)(w + i))));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+    return _mm_cvtsi128_si32(s);
+
+#elif defined(__SSE2__)
+
+    const __m128i zero = _mm_setzero_si128(), max = _mm_set1_epi16(127);
+    __m128i sum = _mm_setzero_si128();
+
+    for (int i = 0; i < Half; i += 8)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+        x = _mm_min_epi16(_mm_max_epi16(x, zero), max);
+        sum = _mm_add_epi32(sum, _mm_madd_epi16(x, _mm_loadu_si128((const __m128i*)(w + i))));
+    }
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+
+#else
+
+    int32_t sum = 0;
+    for (int i = 0; i < Half; ++i)
+        sum += std::min(std::max(int(a[i]), 0), 127) * w[i];
+    return sum;
+
+#endif
+  }
+
+} // namespace
+
+
+namespace NN {
+
+bool Enabled;
+
+/// NN::init() fills the network with placeholder weights: every neuron counts
+/// the material of one side, plus some deterministic noise. They play weakly
+/// but cost the same as real weights, so that 'bench' can measure the speed
+/// of the network evaluation without a weights file.
+
+void init() {
+
+  RKISS rk;
+
+  for (Color c = WHITE; c <= BLACK; ++c)
+      for (PieceType pt = PAWN; pt <= KING; ++pt)
+          for (Square s = SQ_A1; s <= SQ_H8; ++s)
+          {
+              int i = feature(WHITE, c, pt, s);
+              int value = c == WHITE && pt != KING ? PieceValue[MG][pt] / 128 : 0;
+
+              for (int j = 0; j < Half; ++j)
+                  Net.featureWeights[i][j] = int16_t(value + int(rk.rand<unsigned>() % 3) - 1);
+          }
+
+  for (int j = 0; j < Half; ++j)
+  {
+      Net.featureBias[j] = 0;
+      Net.outputWeights[j] = int16_t(48 + rk.rand<unsigned>() % 33);
+      Net.outputWeights[Half + j] = int16_t(-Net.outputWeights[j]);
+  }
+
+  Net.outputBias = 0;
+  Loaded = Placeholder = true;
+}
+
+
+/// NN::load() reads the weights file, see Magic above. On failure the current
+/// weights are kept and false is returned.
+
+bool load(const std::string& fname) {
+
+  std::ifstream f(fname.c_str(), std::ios::binary);
+  char magic[4];
+  Network* net = new Network;
+
+  bool ok =   f.read(magic, sizeof(magic))
+           && !std::memcmp(magic, Magic, sizeof(magic))
+           && f.read((char*)net->featureWeights, sizeof(net->featureWeights))
+           && f.read((char*)net->featureBias, sizeof(net->featureBias))
+           && f.read((char*)net->outputWeights, sizeof(net->outputWeights))
+           && f.read((char*)&net->outputBias, sizeof(net->outputBias))
+           && f.peek() == EOF;
+  if (ok)
+  {
+      Net = *net;
+      Loaded = true;
+      Placeholder = false;
+  }
+  delete net;
+  return ok;
+}
+
+bool loaded() { return Loaded && !Placeholder; }
+
+
+/// NN::set_enabled() switches the network evaluation on or off. It stays off
+/// until a weights file has been loaded.
+
+void set_enabled(bool b) { Enabled = b && loaded(); }
+
+
+void add(Accumulator& acc, Color c, PieceType pt, Square s) {
+
+  for (Color view = WHITE; view <= BLACK; ++view)
+  {
+      const int16_t* w = Net.featureWeights[feature(view, c, pt, s)];
+      for (int j = 0; j < Half; ++j)
+          acc.v[view][j] += w[j];
+  }
+}
+
+void remove(Accumulator& acc, Color c, PieceType pt, Square s) {
+
+  for (Color view = WHITE; view <= BLACK; ++view)
+  {
+      const int16_t* w = Net.featureWeights[feature(view, c, pt, s)];
+      for (int j = 0; j < Half; ++j)
+          acc.v[view][j] -= w[j];
+  }
+}
+
+void move(Accumulator& acc, Color c, PieceType pt, Square from, Square to) {
+
+  for (Color view = WHITE; view <= BLACK; ++view)
+  {
+      const int16_t* wf = Net.featureWeights[feature(view, c, pt, from)];
+      const int16_t* wt = Net.featureWeights[feature(view, c, pt, to)];
+      for (int j = 0; j < Half; ++j)
+          acc.v[view][j] += wt[j] - wf[j];
+  }
+}
+
+
+/// NN::evaluate() returns the network score for the side to move. The
+/// accumulator is computed from scratch only when do_move() could not update
+/// it, e.g. at the root or after the network has just been enabled. Past the
+/// end of the thread's stack a temporary one is used.
+
+Value evaluate(const Position& pos) {
+
+  Accumulator tmp;
+  Accumulator& acc = pos.accumulator() ? *pos.accumulator() : tmp;
+
+  if (&acc == &tmp || acc.key != pos.key())
+      refresh(pos, acc);
+
+  Color us = pos.side_to_move();
+  int32_t out =  Net.outputBias
+               + affine(acc.v[us], Net.outputWeights)
+               + affine(acc.v[~us], Net.outputWeights + Half);
+
+  Value v = Value(out / OutputScale);
+  return std::max(-VALUE_KNOWN_WIN + 1, std::min(VALUE_KNOWN_WIN - 1, v));
+}
+
+} // namespace NN
@@ -0,0 +1,65 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2013 Marco Costalba, Joona Kiiski, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NN_H_INCLUDED
+#define NN_H_INCLUDED
+
+#include <string>
+
+#include "types.h"
+
+class Position;
+
+namespace NN {
+
+/// A small optional neural evaluation: 768 piece-square inputs per side's
+/// point of view feed a layer of Half int16 neurons (the accumulator), the
+/// two halves are clipped to [0, 127] and a single linear output gives the
+/// score for the side to move. Each thread keeps a stack of accumulators,
+/// one per ply, and StateInfo points at its slot, so the handcrafted eval
+/// does not pay for them. Position::do_move() updates the next slot next to
+/// psq, undo_move() just drops it.
+
+const int Inputs = 2 * 6 * 64; // Color, piece type and square
+const int Half = 128;
+const int StackSize = MAX_PLY_PLUS_6; // Accumulators per thread
+
+/// A slot is valid only for the position whose key it holds. Slots are shared
+/// by all the lines a thread searches, so a slot overwritten meanwhile by
+/// another line is simply refreshed.
+
+struct Accumulator {
+  int16_t v[COLOR_NB][Half]; // Indexed by point of view
+  Key key;
+};
+
+extern bool Enabled;
+
+void init();
+bool load(const std::string& fname);
+bool loaded();
+void set_enabled(bool b);
+void add(Accumulator& acc, Color c, PieceType pt, Square s);
+void remove(Accumulator& acc, Color c, PieceType pt, Square s);
+void move(Accumulator& acc, Color c, PieceType pt, Square from, Square to);
+Value evaluate(const Position& pos);
+
+}
+
+#endif // #ifndef NN_H_INCLUDED
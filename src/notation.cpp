@@ -18,6 +18,7 @@
 */
 
 #include <cassert>
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 #include <stack>
@@ -219,6 +220,88 @@ const string move_to_san(Position& pos, Move m)
 }
 
 
+/// move_from_san() is the inverse of move_to_san(), it parses a move in short
+/// algebraic notation, as found in PGN files, and returns the matching legal
+/// Move or MOVE_NONE. Instead of converting every legal move to SAN and doing
+/// string compares, the token is decoded once and matched against the move
+/// list. Check and annotation suffixes are ignored, as are '=' before the
+/// promotion piece and castling written with zeros.
+
+Move move_from_san(const Position& pos, const string& str)
+{
+  size_t end = str.size();
+
+  while (end && strchr("+#!?", str[end - 1]))
+      --end;
+
+  if (end < 2)
+      return MOVE_NONE;
+
+  const char* s = str.c_str();
+  bool castle = (end == 3 || end == 5) && (s[0] == 'O' || s[0] == '0');
+  PieceType pt = PAWN, promotion = NO_PIECE_TYPE;
+  int fromFile = -1, fromRank = -1;
+  Square to = SQ_NONE;
+
+  if (castle)
+  {
+      for (size_t i = 0; i < end; ++i)
+          if (s[i] != (i % 2 ? '-' : s[0]))
+              return MOVE_NONE;
+  }
+  else
+  {
+      const char* p = strchr(PieceToChar[WHITE] + 2, s[end - 1]); // Skip pawn
+
+      if (p && *p != 'K')
+      {
+          promotion = PieceType(p - PieceToChar[WHITE]);
+          end -= (s[end - 2] == '=') ? 2 : 1;
+      }
+
+      if (end < 2 || s[end - 2] < 'a' || s[end - 2] > 'h' || s[end - 1] < '1' || s[end - 1] > '8')
+          return MOVE_NONE;
+
+      to = File(s[end - 2] - 'a') | Rank(s[end - 1] - '1');
+      size_t i = 0;
+
+      if ((p = strchr(PieceToChar[WHITE] + 2, s[0])) != NULL)
+          pt = PieceType(p - PieceToChar[WHITE]), i = 1;
+
+      for ( ; i < end - 2; ++i)
+          if (s[i] >= 'a' && s[i] <= 'h')
+              fromFile = s[i] - 'a';
+          else if (s[i] >= '1' && s[i] <= '8')
+              fromRank = s[i] - '1';
+          else if (s[i] != 'x' && s[i] != '-' && s[i] != ':')
+              return MOVE_NONE;
+  }
+
+  for (const ExtMove& ms : MoveList<LEGAL>(pos))
+  {
+      Move m = ms.move;
+      Square from = from_sq(m);
+
+      if (castle || type_of(m) == CASTLE)
+      {
+          if (castle && type_of(m) == CASTLE && (to_sq(m) > from) == (end == 3))
+              return m;
+
+          continue;
+      }
+
+      if (   to_sq(m) == to
+          && type_of(pos.piece_on(from)) == pt
+          && (fromFile < 0 || file_of(from) == fromFile)
+          && (fromRank < 0 || rank_of(from) == fromRank)
+          && (type_of(m) == PROMOTION ? promotion_type(m) : NO_PIECE_TYPE) == promotion)
+          return m;
+  }
+
+  return MOVE_NONE;
+}
+
+
 /// pretty_pv() formats human-readable search information, typically to be
 /// appended to the search log file. It uses the two helpers below to pretty
 /// format time and score respectively.
@@ -0,0 +1,176 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2013 Marco Costalba, Joona Kiiski, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "packedpos.h"
+#include "thread.h"
+#include "ucioption.h"
+
+using namespace std;
+
+static_assert(sizeof(PackedPosition) == 32, "PackedPosition must be 32 bytes");
+
+
+/// PackedReader::open() maps the given file, a trailing partial record, if
+/// any, is ignored. Returns false if the file cannot be read.
+
+bool PackedReader::open(const string& fName) {
+
+  close();
+
+#if !defined(_WIN32)
+  int fd = ::open(fName.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (fd == -1)
+      return false;
+
+  bool ok = (fstat(fd, &st) == 0);
+
+  if (ok && st.st_size >= (off_t)sizeof(PackedPosition))
+  {
+      void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if ((ok = (p != MAP_FAILED)))
+      {
+          madvise(p, st.st_size, MADV_SEQUENTIAL);
+          data = (const PackedPosition*)p;
+          count = st.st_size / sizeof(PackedPosition);
+          mapLength = st.st_size;
+          mapped = true;
+      }
+  }
+
+  ::close(fd); // The mapping stays valid
+  return ok;
+#else
+  ifstream file(fName.c_str(), ios::binary);
+
+  if (!file.is_open())
+      return false;
+
+  PackedPosition pp;
+
+  while (file.read((char*)&pp, sizeof(PackedPosition)))
+      buffer.push_back(pp);
+
+  data = buffer.empty() ? NULL : &buffer[0];
+  count = buffer.size();
+  return true;
+#endif
+}
+
+
+/// PackedReader::close() releases the mapping or the buffer
+
+void PackedReader::close() {
+
+#if !defined(_WIN32)
+  if (mapped)
+      munmap(const_cast<PackedPosition*>(data), mapLength);
+#endif
+
+  data = NULL;
+  count = mapLength = 0;
+  mapped = false;
+  buffer.clear();
+}
+
+
+/// PackedWriter::open() creates, or truncates, the given file
+
+bool PackedWriter::open(const string& fName) {
+
+  std::ofstream::open(fName.c_str(), ios::out | ios::binary | ios::trunc);
+  return is_open();
+}
+
+
+/// PackedWriter::write() appends the packed position to the file
+
+void PackedWriter::write(const Position& pos) {
+
+  PackedPosition pp;
+
+  pos.pack(pp);
+  std::ofstream::write((const char*)&pp, sizeof(PackedPosition));
+}
+
+
+/// pack_fens() is called by the "pack" command to convert a file with a FEN
+/// or EPD record per line into a file of packed positions. EPD operations
+/// are dropped and invalid lines are reported and skipped.
+
+void pack_fens(istream& is) {
+
+  string fenFile, binFile, line;
+  Position pos;
+  FenError err;
+  PackedWriter writer;
+  size_t lineNum = 0, packed = 0;
+
+  if (!(is >> fenFile >> binFile))
+  {
+      cerr << "Usage: pack <fen file> <bin file>" << endl;
+      return;
+  }
+
+  ifstream file(fenFile.c_str());
+
+  if (!file.is_open())
+  {
+      cerr << "Unable to open file " << fenFile << endl;
+      return;
+  }
+
+  if (!writer.open(binFile))
+  {
+      cerr << "Unable to create file " << binFile << endl;
+      return;
+  }
+
+  while (getline(file, line))
+  {
+      ++lineNum;
+
+      if (line.empty())
+          continue;
+
+      if (pos.set(line, Options["UCI_Chess960"], Threads.main(), &err))
+      {
+          writer.write(pos);
+          ++packed;
+      }
+      else
+          cerr << fenFile << ":" << lineNum << ": " << err.what
+               << " at column " << err.offset + 1 << endl;
+  }
+
+  writer.close();
+
+  cerr << "Packed " << packed << " positions into " << binFile << endl;
+}
@@ -0,0 +1,65 @@
+/*
+  Stockfish, a UCI chess playing engine derived from Glaurung 2.1
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2013 Marco Costalba, Joona Kiiski, Tord Romstad
+
+  Stockfish is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Stockfish is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PACKEDPOS_H_INCLUDED
+#define PACKEDPOS_H_INCLUDED
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "position.h"
+
+/// PackedReader gives indexed access to a file of PackedPosition records. The
+/// file is memory mapped where supported, so records are used in place with
+/// no parsing nor copying, otherwise it is read in memory in one go.
+
+class PackedReader {
+
+  PackedReader(const PackedReader&);            // Non copyable
+  PackedReader& operator=(const PackedReader&);
+
+public:
+  PackedReader() : data(NULL), count(0), mapLength(0), mapped(false) {}
+ ~PackedReader() { close(); }
+
+  bool open(const std::string& fName);
+  void close();
+  size_t size() const { return count; }
+  const PackedPosition& operator[](size_t idx) const { return data[idx]; }
+
+private:
+  const PackedPosition* data;
+  size_t count;
+  size_t mapLength; // Bytes mapped, the file size
+  bool mapped;
+  std::vector<PackedPosition> buffer;
+};
+
+
+/// PackedWriter appends positions to a file of PackedPosition records
+
+class PackedWriter : private std::ofstream {
+public:
+  bool open(const std::string& fName);
+  void write(const Position& pos);
+  using std::ofstream::close;
+};
+
+#endif // #ifndef PACKEDPOS_H_INCLUDED
@@ -19,6 +19,7 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 
 #include "bitboard.h"
 #include "bitcount.h"
@@ -150,7 +151,7 @@ namespace {
     Bitboard theirPawns = pos.pieces(Them, PAWN);
 
     e->passedPawns[Us] = e->candidatePawns[Us] = 0;
-    e->kingSquares[Us] = SQ_NONE;
+    std::memset(e->kingKeys[Us], 0xFF, sizeof(e->kingKeys[Us]));
     e->semiopenFiles[Us] = 0xFF;
 		/*
 		ԑPAWNi΂ߑOjɓƂbitboardĂ
@@ -439,17 +440,24 @@ Value Entry::shelter_storm(const Position& pos, Square ksq)
 
 
 /// Entry::update_safety() calculates and caches a bonus for king safety. It is
-/// called only when king square changes, about 20% of total king_safety() calls.
+/// called only when the king square and castling rights are not among the
+/// cached ones, see king_safety(); 'bench' reports how often that happens.
 /*
 king_safety֐̂݌Ă΂
 */
 template<Color Us>
-Score Entry::update_safety(const Position& pos, Square ksq) 
+Score Entry::update_safety(const Position& pos, Square ksq, uint8_t k) 
 {
 
-  kingSquares[Us] = ksq;
-  castleRights[Us] = pos.can_castle(Us);
-  minKPdistance[Us] = 0;
+  // Make room for the new result in the most recent slot
+  for (int i = KingSlots - 1; i > 0; --i)
+  {
+      kingKeys[Us][i] = kingKeys[Us][i - 1];
+      kingSafety[Us][i] = kingSafety[Us][i - 1];
+  }
+  kingKeys[Us][0] = k;
+
+  int minKPdistance = 0;
 
   Bitboard pawns = pos.pieces(Us, PAWN);
 	/*
@@ -457,13 +465,13 @@ Score Entry::update_safety(const Position& pos, Square ksq)
 	minKPdistancezɂKINGƎPAWNƂ̃`GrVGt
 	*/
   if (pawns)
-      while (!(DistanceRingsBB[ksq][minKPdistance[Us]++] & pawns)) {}
+      while (!(DistanceRingsBB[ksq][minKPdistance++] & pawns)) {}
 	/*
 	KINGsS傫ꍇiWHITEȂABLACKȂRANK5j
 	KINGPAWNƂ̗ɉăyieBݒ肳
 	*/	
   if (relative_rank(Us, ksq) > RANK_4)
-      return kingSafety[Us] = make_score(0, -16 * minKPdistance[Us]);
+      return kingSafety[Us][0] = make_score(0, -16 * minKPdistance);
 
   Value bonus = shelter_storm<Us>(pos, ksq);
 
@@ -480,11 +488,11 @@ Score Entry::update_safety(const Position& pos, Square ksq)
 	KINGRANK4łĂȂ
 	KINGPAWNƂ̗ɉĂbonusliHjyieBݒ肳
 	*/
-  return kingSafety[Us] = make_score(bonus, -16 * minKPdistance[Us]);
+  return kingSafety[Us][0] = make_score(bonus, -16 * minKPdistance);
 }
 
 // Explicit template instantiation
-template Score Entry::update_safety<WHITE>(const Position& pos, Square ksq);
-template Score Entry::update_safety<BLACK>(const Position& pos, Square ksq);
+template Score Entry::update_safety<WHITE>(const Position& pos, Square ksq, uint8_t k);
+template Score Entry::update_safety<BLACK>(const Position& pos, Square ksq, uint8_t k);
 
 } // namespace Pawns
@@ -26,6 +26,13 @@
 
 namespace Pawns {
 
+/// KingSafetyStats counts the king_safety() lookups of a thread and how many
+/// of them missed the per-entry cache, reported by bench.
+struct KingSafetyStats {
+  uint64_t probes, misses;
+};
+
+
 /// Pawns::Entry contains various information about a pawn structure. Currently,
 /// it only includes a middle game and end game pawn structure evaluation, and a
 /// bitboard of passed pawns. We may want to add further information in the future.
@@ -51,14 +58,21 @@ struct Entry {
 	evaluate_king֐̂݌Ă΂
 	*/
   template<Color Us>
-  Score king_safety(const Position& pos, Square ksq)  {
+  Score king_safety(const Position& pos, Square ksq, KingSafetyStats& stats)  {
 
-    return kingSquares[Us] == ksq && castleRights[Us] == pos.can_castle(Us)
-         ? kingSafety[Us] : update_safety<Us>(pos, ksq);
+    uint8_t k = uint8_t(ksq | (pos.can_castle(Us) >> (2 * Us)) << 6);
+
+    ++stats.probes;
+    for (int i = 0; i < KingSlots; ++i)
+        if (kingKeys[Us][i] == k)
+            return kingSafety[Us][i];
+
+    ++stats.misses;
+    return update_safety<Us>(pos, ksq, k);
   }
 
   template<Color Us>
-  Score update_safety(const Position& pos, Square ksq);
+  Score update_safety(const Position& pos, Square ksq, uint8_t k);
 
   template<Color Us>
   Value shelter_storm(const Position& pos, Square ksq);
@@ -67,12 +81,15 @@ struct Entry {
   Bitboard passedPawns[COLOR_NB];
   Bitboard candidatePawns[COLOR_NB];
   Bitboard pawnAttacks[COLOR_NB];
-  Square kingSquares[COLOR_NB];
-  int minKPdistance[COLOR_NB];
-  int castleRights[COLOR_NB];
   Score value;
   int semiopenFiles[COLOR_NB];
-  Score kingSafety[COLOR_NB];
+
+  // The last KingSlots king safety results per color, most recent first,
+  // keyed by king square | castling rights << 6 (0xFF, an impossible key,
+  // marks an empty slot), so that a king moving back and forth still hits.
+  static const int KingSlots = 4;
+  uint8_t kingKeys[COLOR_NB][KingSlots];
+  Score kingSafety[COLOR_NB][KingSlots];
   int pawnsOnSquares[COLOR_NB][COLOR_NB];
 };
 
@@ -274,6 +274,7 @@ Position& Position::operator=(const Position& pos)
   std::memcpy(this, &pos, sizeof(Position));
   startState = *m_st;
   m_st = &startState;
+  m_st->accumulator = thisThread ? thisThread->accumulators : NULL;
   nodes = 0;
 
   assert(pos_is_ok());
@@ -282,13 +283,58 @@ Position& Position::operator=(const Position& pos)
 }
 
 
+/// Position::Position() copies 'pos' for use by thread 't', e.g. at a split
+/// point. The copy gets its own accumulator stack, the one of 't'.
+
+Position::Position(const Position& pos, Thread* t) {
+
+  *this = pos;
+  thisThread = t;
+  m_st->accumulator = t->accumulators;
+}
+
+
 /// Position::set() initializes the position object with the given FEN string.
-/// This function is not very robust - make sure that input FENs are correct,
-/// this is assumed to be the responsibility of the GUI.
-/*
-FEN stringǂݍŋǖʂݒ肵Ă
-*/
-void Position::set(const string& fenStr, bool isChess960, Thread* th) 
+/// The record is parsed in place, without any allocation, and may also be an
+/// EPD record: the halfmove clock and fullmove number are then optional and,
+/// if 'end' is not NULL, it receives a pointer to the first character not
+/// consumed (the EPD operations, if any). Returns false if the record is
+/// malformed or describes a position the engine cannot handle; in that case
+/// 'err', if not NULL, reports what is wrong and where, and the position
+/// object must be set again before being used.
+
+namespace {
+
+  const char* skip_blanks(const char* s) {
+
+    while (*s == ' ' || *s == '\t')
+        ++s;
+
+    return s;
+  }
+
+  bool fen_error(FenError* err, const char* what, const char* fen, const char* at) {
+
+    if (err)
+    {
+        err->what = what;
+        err->offset = int(at - fen);
+    }
+    return false;
+  }
+
+  // Reads a move counter, returns NULL if too big to be sensible
+  const char* parse_counter(const char* s, int* n) {
+
+    for (*n = 0; *s >= '0' && *s <= '9'; ++s)
+        if ((*n = *n * 10 + (*s - '0')) > 99999)
+            return NULL;
+
+    return s;
+  }
+}
+
+bool Position::set(const char* fenStr, bool isChess960, Thread* th, FenError* err, const char** end)
 {
 /*
    A FEN string defines a particular position using only the ASCII character set.
@@ -324,105 +370,300 @@ void Position::set(const string& fenStr, bool isChess960, Thread* th)
       incremented after Black's move.
 */
 
-  char col, row, token;
+  const char* s = skip_blanks(fenStr);
+  int file = 0, rank = 7, pieceTotal[COLOR_NB] = { 0, 0 };
   size_t p;
-  Square sq = SQ_A8;
-  std::istringstream ss(fenStr);
 
   clear();
-	//󔒕XLbvȂݒ
-	ss >> std::noskipws;
 
   // 1. Piece placement
-	/*
-	FEN string̃XLA8->B8->...->H8
-	A7->B7..->H7
-	A1->B1->..H1ƓǂݎĂs
-	*/
-	while ((ss >> token) && !isspace(token))
+  for ( ; *s && *s != ' ' && *s != '\t'; ++s)
   {
-			//͋󔒂\̂ŐlWZ
-			if (isdigit(token))
-          sq += Square(token - '0'); // Advance the given number of files
-			/*
-			FEN strinǧ{
-			"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
-			*/
-			else if (token == '/')
-          sq -= Square(16);
-			//FEN stringR[hɕϊput_pieceĂœf[^XVĂ
-			else if ((p = PieceToChar.find(token)) != string::npos)
+      if (*s >= '1' && *s <= '8')
+      {
+          if ((file += *s - '0') > 8)
+              return fen_error(err, "too many squares in a rank", fenStr, s);
+      }
+      else if (*s == '/')
+      {
+          if (file != 8 || rank == 0)
+              return fen_error(err, "wrong number of squares in a rank", fenStr, s);
+
+          file = 0;
+          --rank;
+      }
+      else if ((p = PieceToChar.find(*s)) != string::npos)
       {
-          put_piece(sq, color_of(Piece(p)), type_of(Piece(p)));
-          ++sq;
+          Color c = color_of(Piece(p));
+          PieceType pt = type_of(Piece(p));
+
+          if (file == 8)
+              return fen_error(err, "too many squares in a rank", fenStr, s);
+
+          if (pt == PAWN && (rank == 0 || rank == 7))
+              return fen_error(err, "pawn on first or last rank", fenStr, s);
+
+          if (++pieceTotal[c] > 16)
+              return fen_error(err, "more than 16 pieces of one color", fenStr, s);
+
+          put_piece(File(file++) | Rank(rank), c, pt);
       }
+      else
+          return fen_error(err, "invalid character in piece placement", fenStr, s);
   }
 
+  if (file != 8 || rank != 0)
+      return fen_error(err, "wrong number of squares in piece placement", fenStr, s);
+
+  if (count<KING>(WHITE) != 1 || count<KING>(BLACK) != 1)
+      return fen_error(err, "each side must have exactly one king", fenStr, s);
+
   // 2. Active color
-  ss >> token;
-  sideToMove = (token == 'w' ? WHITE : BLACK);
-  ss >> token;
+  s = skip_blanks(s);
+
+  if (*s == 'w' || *s == 'b')
+      sideToMove = (*s++ == 'w' ? WHITE : BLACK);
+  else
+      return fen_error(err, "side to move must be 'w' or 'b'", fenStr, s);
 
   // 3. Castling availability. Compatible with 3 standards: Normal FEN standard,
   // Shredder-FEN that uses the letters of the columns on which the rooks began
   // the game instead of KQkq and also X-FEN standard that, in case of Chess960,
   // if an inner rook is associated with the castling right, the castling tag is
   // replaced by the file letter of the involved rook, as for the Shredder-FEN.
-	//LXOɊւ邱Ƃ̂悤ڍוs
-	while ((ss >> token) && !isspace(token))
+  s = skip_blanks(s);
+
+  if (*s == '-')
+      ++s;
+  else if (!*s)
+      return fen_error(err, "missing castling availability", fenStr, s);
+  else for ( ; *s && *s != ' ' && *s != '\t'; ++s)
   {
-      Square rsq;
-      Color c = islower(token) ? BLACK : WHITE;
+      Square rsq, ksq;
+      Color c = islower(*s) ? BLACK : WHITE;
+      char token = char(toupper(*s));
+      Piece rook = make_piece(c, ROOK);
+
+      ksq = king_square(c);
 
-      token = char(toupper(token));
+      if (rank_of(ksq) != relative_rank(c, RANK_1))
+          return fen_error(err, "castling right with the king off its first rank", fenStr, s);
 
       if (token == 'K')
-          for (rsq = relative_square(c, SQ_H1); type_of(piece_on(rsq)) != ROOK; --rsq) {}
+          for (rsq = relative_square(c, SQ_H1); rsq > ksq && piece_on(rsq) != rook; --rsq) {}
 
       else if (token == 'Q')
-          for (rsq = relative_square(c, SQ_A1); type_of(piece_on(rsq)) != ROOK; ++rsq) {}
+          for (rsq = relative_square(c, SQ_A1); rsq < ksq && piece_on(rsq) != rook; ++rsq) {}
 
       else if (token >= 'A' && token <= 'H')
           rsq = File(token - 'A') | relative_rank(c, RANK_1);
 
       else
-          continue;
+          return fen_error(err, "invalid character in castling availability", fenStr, s);
+
+      if (piece_on(rsq) != rook)
+          return fen_error(err, "no rook for castling right", fenStr, s);
 
       set_castle_right(c, rsq);
   }
 
   // 4. En passant square. Ignore if no pawn capture is possible
-	//ApT
-	if (((ss >> col) && (col >= 'a' && col <= 'h'))
-      && ((ss >> row) && (row == '3' || row == '6')))
+  s = skip_blanks(s);
+
+  if (*s == '-')
+      ++s;
+  else if (   s[0] >= 'a' && s[0] <= 'h'
+           && s[1] == (sideToMove == WHITE ? '6' : '3'))
   {
-      m_st->epSquare = File(col - 'a') | Rank(row - '1');
+      Square ep = File(s[0] - 'a') | Rank(s[1] - '1');
 
-      if (!(attackers_to(m_st->epSquare) & pieces(sideToMove, PAWN)))
-          m_st->epSquare = SQ_NONE;
+      if (   empty(ep)
+          && piece_on(ep - pawn_push(sideToMove)) == make_piece(~sideToMove, PAWN)
+          && (attackers_to(ep, pieces()) & pieces(sideToMove, PAWN)))
+          m_st->epSquare = ep;
+
+      s += 2;
   }
+  else
+      return fen_error(err, "invalid en passant square", fenStr, s);
 
-  // 5-6. Halfmove clock and fullmove number
-	/*
-	Halfmove
-	https://chessprogramming.wikispaces.com/Halfmove+Clock
+  if (*s && *s != ' ' && *s != '\t')
+      return fen_error(err, "unexpected character after en passant square", fenStr, s);
 
-	std::skipws̓}js[^i擪̋󔒂ǂݔ΂j
-	m_st->rule50͂TO胋[̃tOƎvĂႤ悤
-	̕ϐ50𐔂ĂAdo_move֐ŃJEgAbv99ɒBɂȂ
-	TO胋[KpĂ
-	gamePly萔萔Ȃǂssɓ͂Ă
-	*/
-	ss >> std::skipws >> m_st->rule50 >> gamePly;
+  // 5-6. Halfmove clock and fullmove number, both optional as in EPD
+  const char* t = skip_blanks(s);
+
+  if (*t >= '0' && *t <= '9')
+  {
+      if (!(t = parse_counter(t, &m_st->rule50)))
+          return fen_error(err, "halfmove clock out of range", fenStr, skip_blanks(s));
+
+      s = t;
+      t = skip_blanks(s);
+
+      if (*t >= '0' && *t <= '9')
+      {
+          if (!(s = parse_counter(t, &gamePly)))
+              return fen_error(err, "fullmove number out of range", fenStr, t);
+      }
+  }
+
+  if (end)
+      *end = skip_blanks(s);
 
   // Convert from fullmove starting from 1 to ply starting from 0,
   // handle also common incorrect FEN with fullmove = 0.
-	gamePly = std::max(2 * (gamePly - 1), 0) + int(sideToMove == BLACK);
-	//ǖʕ̂߂̏
-	m_st->key = compute_key();
+  gamePly = std::max(2 * (gamePly - 1), 0) + int(sideToMove == BLACK);
+
+  // The attack maps are not built yet, so compute the attackers from the board
+  if (attackers_to(king_square(~sideToMove), pieces()) & pieces(sideToMove))
+      return fen_error(err, "side not to move is in check", fenStr, fenStr);
+
+  set_state(isChess960, th);
+
+  return true;
+}
+
+
+/// Position::set() initializes the position object from a packed record, as
+/// stored in dataset files. The same checks of the FEN version are done, and
+/// in case of error 'err' reports the offset of the offending field.
+
+bool Position::set(const PackedPosition& pp, Thread* th, FenError* err)
+{
+  const char* base = (const char*)&pp;
+  int pieceTotal[COLOR_NB] = { 0, 0 };
+  Bitboard castleRooks = 0;
+
+  clear();
+
+  if (popcount<Full>(pp.occupied) > 32)
+      return fen_error(err, "more than 32 pieces", base, base + offsetof(PackedPosition, occupied));
+
+  // Place the pieces in the same order as the FEN parser does, so that piece
+  // lists, and hence move generation order and search, are the same whatever
+  // the source of the position.
+  for (Rank r = RANK_8; r >= RANK_1; --r)
+      for (Bitboard b = pp.occupied & rank_bb(r); b; )
+      {
+          Square s = pop_lsb(&b);
+          int idx = popcount<Full>(pp.occupied & (SquareBB[s] - 1));
+          int code = (pp.pieces[idx / 2] >> (4 * (idx & 1))) & 0xF;
+
+          if (code == PackedPosition::CastleRook || code == PackedPosition::CastleRook + 8)
+          {
+              castleRooks |= s;
+              code = make_piece(Color(code >> 3), ROOK);
+          }
+
+          Piece pc = Piece(code);
+          const char* at = base + offsetof(PackedPosition, pieces) + idx / 2;
+
+          if (type_of(pc) < PAWN || type_of(pc) > KING)
+              return fen_error(err, "invalid piece code", base, at);
+
+          if (type_of(pc) == PAWN && (rank_of(s) == RANK_1 || rank_of(s) == RANK_8))
+              return fen_error(err, "pawn on first or last rank", base, at);
+
+          if (++pieceTotal[color_of(pc)] > 16)
+              return fen_error(err, "more than 16 pieces of one color", base, at);
+
+          put_piece(s, color_of(pc), type_of(pc));
+      }
+
+  if (count<KING>(WHITE) != 1 || count<KING>(BLACK) != 1)
+      return fen_error(err, "each side must have exactly one king", base, base + offsetof(PackedPosition, pieces));
+
+  sideToMove = (pp.flags & PackedPosition::BlackToMove) ? BLACK : WHITE;
+
+  while (castleRooks)
+  {
+      Square rsq = pop_lsb(&castleRooks);
+      Color c = color_of(piece_on(rsq));
+      Square ksq = king_square(c);
+
+      if (   rank_of(ksq) != relative_rank(c, RANK_1)
+          || rank_of(rsq) != relative_rank(c, RANK_1)
+          || can_castle(make_castle_right(c, ksq < rsq ? KING_SIDE : QUEEN_SIDE)))
+          return fen_error(err, "invalid castling rook", base, base + offsetof(PackedPosition, pieces));
+
+      set_castle_right(c, rsq);
+  }
+
+  if (pp.epSquare != SQ_NONE)
+  {
+      Square ep = Square(pp.epSquare);
+
+      if (   !is_ok(ep)
+          || relative_rank(sideToMove, ep) != RANK_6
+          || !empty(ep)
+          || piece_on(ep - pawn_push(sideToMove)) != make_piece(~sideToMove, PAWN))
+          return fen_error(err, "invalid en passant square", base, base + offsetof(PackedPosition, epSquare));
+
+      // Ignore it if no pawn capture is possible, as the FEN parser does, so
+      // that both give the same key.
+      if (attackers_to(ep, pieces()) & pieces(sideToMove, PAWN))
+          m_st->epSquare = ep;
+  }
+
+  m_st->rule50 = pp.rule50;
+  gamePly = std::max(2 * (pp.fullmove - 1), 0) + int(sideToMove == BLACK);
+
+  // The attack maps are not built yet, so compute the attackers from the board
+  if (attackers_to(king_square(~sideToMove), pieces()) & pieces(sideToMove))
+      return fen_error(err, "side not to move is in check", base, base);
+
+  set_state(pp.flags & PackedPosition::Chess960, th);
+
+  return true;
+}
+
+
+/// Position::pack() stores the position in the fixed size binary format read
+/// back by the above set(). Rooks that still have castling rights get their
+/// own piece code so that Chess960 castling needs no extra field.
+
+void Position::pack(PackedPosition& pp) const
+{
+  int idx = 0;
+
+  std::memset(&pp, 0, sizeof(PackedPosition));
+  pp.occupied = pieces();
+
+  for (Bitboard b = pieces(); b; ++idx)
+  {
+      Square s = pop_lsb(&b);
+      int code = piece_on(s);
+
+      if (type_of(piece_on(s)) == ROOK && (castleRightsMask[s] & m_st->castleRights))
+          code = PackedPosition::CastleRook + 8 * color_of(piece_on(s));
+
+      pp.pieces[idx / 2] |= uint8_t(code << (4 * (idx & 1)));
+  }
+
+  pp.flags = uint8_t(  (sideToMove == BLACK ? PackedPosition::BlackToMove : 0)
+                     | (chess960 ? PackedPosition::Chess960 : 0));
+  pp.epSquare = uint8_t(ep_square());
+  pp.rule50 = uint16_t(m_st->rule50);
+  pp.fullmove = uint16_t(1 + (gamePly - int(sideToMove == BLACK)) / 2);
+}
+
+
+/// Position::set_state() completes the setup of a position once the board,
+/// side to move, castling rights, en passant square and counters are in place,
+/// computing from scratch all the incrementally updated data.
+
+void Position::set_state(bool isChess960, Thread* th)
+{
+#ifdef USE_ATTACK_MAPS
+  compute_attack_maps();
+#endif
+
+  m_st->key = compute_key();
   m_st->pawnKey = compute_pawn_key();
   m_st->materialKey = compute_material_key();
   m_st->psq = compute_psq_score();
+  m_st->accumulator = th ? th->accumulators : NULL;
   m_st->npMaterial[WHITE] = compute_non_pawn_material(WHITE);
   m_st->npMaterial[BLACK] = compute_non_pawn_material(BLACK);
   m_st->checkersBB = attackers_to(king_square(sideToMove)) & pieces(~sideToMove);
@@ -463,17 +704,29 @@ void Position::set_castle_right(Color c, Square rfrom)
 }
 
 
-/// Position::fen() returns a FEN representation of the position. In case
-/// of Chess960 the Shredder-FEN notation is used. Mainly a debugging function.
-/*
-Position::fen() returns a FEN representation of the position. In case of
-Chess960 the Shredder-FEN notation is used. This is mainly a debugging function.
-f[^FEN stringグ
-*/
-const string Position::fen() const 
-{
+/// Position::fen() writes a FEN representation of the position into 'buf',
+/// that must have room for at least MAX_FEN_LENGTH characters, and returns a
+/// pointer to the terminating null. If 'epd' is set the move counters are
+/// omitted, giving the first four fields of an EPD record. In case of Chess960
+/// the Shredder-FEN notation is used. No allocation is done.
 
-  std::ostringstream ss;
+namespace {
+
+  char* write_counter(char* s, int n) {
+
+    char digits[12], *d = digits;
+
+    do *d++ = char('0' + n % 10); while (n /= 10);
+    while (d != digits)
+        *s++ = *--d;
+
+    return s;
+  }
+}
+
+char* Position::fen(char* buf, bool epd) const
+{
+  char* s = buf;
 
   for (Rank rank = RANK_8; rank >= RANK_1; --rank)
   {
@@ -488,37 +741,69 @@ const string Position::fen() const
               for ( ; file < FILE_H && empty(++sq); ++file)
                   ++emptyCnt;
 
-              ss << emptyCnt;
+              *s++ = char('0' + emptyCnt);
           }
           else
-              ss << PieceToChar[piece_on(sq)];
+              *s++ = PieceToChar[piece_on(sq)];
       }
 
       if (rank > RANK_1)
-          ss << '/';
+          *s++ = '/';
   }
 
-  ss << (sideToMove == WHITE ? " w " : " b ");
+  *s++ = ' ';
+  *s++ = (sideToMove == WHITE ? 'w' : 'b');
+  *s++ = ' ';
 
   if (can_castle(WHITE_OO))
-      ss << (chess960 ? file_to_char(file_of(castle_rook_square(WHITE,  KING_SIDE)), false) : 'K');
+      *s++ = (chess960 ? file_to_char(file_of(castle_rook_square(WHITE,  KING_SIDE)), false) : 'K');
 
   if (can_castle(WHITE_OOO))
-      ss << (chess960 ? file_to_char(file_of(castle_rook_square(WHITE, QUEEN_SIDE)), false) : 'Q');
+      *s++ = (chess960 ? file_to_char(file_of(castle_rook_square(WHITE, QUEEN_SIDE)), false) : 'Q');
 
   if (can_castle(BLACK_OO))
-      ss << (chess960 ? file_to_char(file_of(castle_rook_square(BLACK,  KING_SIDE)),  true) : 'k');
+      *s++ = (chess960 ? file_to_char(file_of(castle_rook_square(BLACK,  KING_SIDE)),  true) : 'k');
 
   if (can_castle(BLACK_OOO))
-      ss << (chess960 ? file_to_char(file_of(castle_rook_square(BLACK, QUEEN_SIDE)),  true) : 'q');
+      *s++ = (chess960 ? file_to_char(file_of(castle_rook_square(BLACK, QUEEN_SIDE)),  true) : 'q');
 
   if (m_st->castleRights == CASTLES_NONE)
-      ss << '-';
+      *s++ = '-';
 
-  ss << (ep_square() == SQ_NONE ? " - " : " " + square_to_string(ep_square()) + " ")
-      << m_st->rule50 << " " << 1 + (gamePly - int(sideToMove == BLACK)) / 2;
+  *s++ = ' ';
 
-  return ss.str();
+  if (ep_square() == SQ_NONE)
+      *s++ = '-';
+  else
+  {
+      *s++ = file_to_char(file_of(ep_square()));
+      *s++ = rank_to_char(rank_of(ep_square()));
+  }
+
+  if (!epd)
+  {
+      *s++ = ' ';
+      s = write_counter(s, m_st->rule50);
+      *s++ = ' ';
+      s = write_counter(s, 1 + (gamePly - int(sideToMove == BLACK)) / 2);
+  }
+
+  *s = '\0';
+
+  assert(s - buf < MAX_FEN_LENGTH);
+
+  return s;
+}
+
+
+/// Position::fen() returns the FEN string of the position, a convenience
+/// wrapper of the above used where speed does not matter.
+
+const string Position::fen() const
+{
+  char buf[MAX_FEN_LENGTH];
+
+  return string(buf, fen(buf));
 }
 
 
@@ -1040,6 +1325,9 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
 	newSt.previous = m_st;
   m_st = &newSt;
 
+  // Update the network accumulator along with psq
+  NN::Accumulator* acc = push_accumulator();
+
   // Update side to move
 	/*
 	ǖʂ̃nbVlXVĂ
@@ -1069,6 +1357,11 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
   assert(piece_on(to) == NO_PIECE || color_of(piece_on(to)) == them || type_of(m) == CASTLE);
   assert(captured != KING);
 
+#ifdef USE_ATTACK_MAPS
+  Bitboard changed = move_squares(m, us);
+  Bitboard affected = detach_attacks(changed);
+#endif
+
   if (type_of(m) == CASTLE)
   {
       assert(pc == make_piece(us, KING));
@@ -1082,6 +1375,8 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
       do_castle(from, to, rfrom, rto);
 
 			m_st->psq += piece_sq_score[us][ROOK][rto] - piece_sq_score[us][ROOK][rfrom];
+      if (acc)
+          NN::move(*acc, us, ROOK, rfrom, rto);
       k ^= Zobrist::psq[us][ROOK][rfrom] ^ Zobrist::psq[us][ROOK][rto];
   }
 	/*
@@ -1126,20 +1421,21 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
 			*/
 			remove_piece(capsq, them, captured);
 
-      // Update material hash key and prefetch access to materialTable
+      // Update material hash key
 			/*
 			ǖʂ̃nbVlꂽ̃nbVlĂ
 			materialKeyύXĂ
 			*/
 			k ^= Zobrist::psq[them][captured][capsq];
       m_st->materialKey ^= Zobrist::psq[them][captured][pieceCount[them][captured]];
-      prefetch((char*)thisThread->materialTable[m_st->materialKey]);
 
       // Update incremental scores
 			/*
 			m_st->psq͈ʒu]l̏WvlȂ̂Ŏꂽ̍Ă
 			*/
 			m_st->psq -= piece_sq_score[them][captured][capsq];
+      if (acc)
+          NN::remove(*acc, them, captured, capsq);
 
       // Reset rule 50 counter
 			/*
@@ -1234,6 +1530,11 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
           // Update incremental score
 					//ʒu]lXV
 					m_st->psq += piece_sq_score[us][promotion][to] - piece_sq_score[us][PAWN][to];
+          if (acc)
+          {
+              NN::remove(*acc, us, PAWN, to);
+              NN::add(*acc, us, promotion, to);
+          }
 
           // Update material
 					/*
@@ -1260,6 +1561,8 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
 	ʒu]l̍XV
 	*/
 	m_st->psq += piece_sq_score[us][pt][to] - piece_sq_score[us][pt][from];
+  if (acc)
+      NN::move(*acc, us, pt, from, to);
 
   // Set capture piece
 	/*
@@ -1273,6 +1576,13 @@ void Position::do_move(Move m, StateInfo& newSt, const CheckInfo& ci, bool moveI
 	*/
 	m_st->key = k;
 
+  if (acc)
+      acc->key = k;
+
+#ifdef USE_ATTACK_MAPS
+  attach_attacks(affected | (changed & pieces()));
+#endif
+
   // Update checkers bitboard, piece must be already moved
   m_st->checkersBB = 0;
 	/*
@@ -1341,6 +1651,11 @@ void Position::undo_move(Move m)
 
   assert(empty(from) || type_of(m) == CASTLE);
   assert(captured != KING);
+
+#ifdef USE_ATTACK_MAPS
+  Bitboard changed = move_squares(m, us);
+  Bitboard affected = detach_attacks(changed);
+#endif
 	/*
 	wp^[p^[Ȃ
 	*/
@@ -1402,6 +1717,10 @@ void Position::undo_move(Move m)
       put_piece(capsq, them, captured); // Restore the captured piece
   }
 
+#ifdef USE_ATTACK_MAPS
+  attach_attacks(affected | (changed & pieces()));
+#endif
+
   // Finally point our state pointer back to the previous state
 	/*
 	StateInfoP߂Ă,m_stwĂStateInfo͎ϐȂ̂Ń[[N̐Sz͂Ȃ
@@ -1431,6 +1750,115 @@ void Position::do_castle(Square kfrom, Square kto, Square rfrom, Square rto)
 }
 
 
+#ifdef USE_ATTACK_MAPS
+
+/// Position::move_squares() returns the squares whose occupancy is changed by
+/// the given move: origin, destination and, for the special moves, the captured
+/// en passant pawn or the castling rook squares.
+
+Bitboard Position::move_squares(Move m, Color us) const
+{
+  Square from = from_sq(m);
+  Square to = to_sq(m);
+  Bitboard b = SquareBB[from] | to;
+
+  if (type_of(m) == ENPASSANT)
+      b |= to - pawn_push(us);
+
+  else if (type_of(m) == CASTLE)
+  {
+      bool kingSide = to > from;
+      b |= relative_square(us, kingSide ? SQ_G1 : SQ_C1);
+      b |= relative_square(us, kingSide ? SQ_F1 : SQ_D1);
+  }
+
+  return b;
+}
+
+
+/// Position::detach_attacks() is called before the board is changed. It removes
+/// from the attack maps the attacks of the pieces standing on the 'changed'
+/// squares and of the sliders whose rays reach them. Attacks to a square do not
+/// depend on its occupancy, so the same sliders are the ones to be reattached
+/// after the move and are returned to the caller.
+
+Bitboard Position::detach_attacks(Bitboard changed)
+{
+  Bitboard sliders = 0, affected;
+
+  for (Bitboard b = changed; b; )
+      sliders |= attackersToBB[pop_lsb(&b)];
+
+  sliders &= pieces(BISHOP, ROOK) | pieces(QUEEN);
+  affected = sliders | (changed & pieces());
+
+  while (affected)
+  {
+      Square s = pop_lsb(&affected);
+
+      for (Bitboard b = attacksFromBB[s]; b; )
+          attackersToBB[pop_lsb(&b)] ^= s;
+
+      attacksFromBB[s] = 0;
+  }
+
+  return sliders & ~changed;
+}
+
+
+/// Position::attach_attacks() computes, with the board already updated, the
+/// attacks of the 'affected' pieces and adds them to the attack maps.
+
+void Position::attach_attacks(Bitboard affected)
+{
+  while (affected)
+  {
+      Square s = pop_lsb(&affected);
+      Bitboard att = attacksFromBB[s] = attacks_from(piece_on(s), s);
+
+      while (att)
+          attackersToBB[pop_lsb(&att)] |= s;
+  }
+}
+
+
+/// Position::compute_attack_maps() sets up the attack maps from scratch when
+/// a new position is set.
+
+void Position::compute_attack_maps()
+{
+  std::memset(attacksFromBB, 0, sizeof(attacksFromBB));
+  std::memset(attackersToBB, 0, sizeof(attackersToBB));
+  attach_attacks(pieces());
+}
+
+#endif
+
+
+/// Position::push_accumulator() points the new state at the next slot of the
+/// thread's accumulator stack, if the network is on and there is one left.
+/// The previous values are copied there when valid; then the slot is returned
+/// for an incremental update and the caller stamps it with the new key.
+
+NN::Accumulator* Position::push_accumulator() {
+
+  NN::Accumulator* prev = m_st->previous->accumulator;
+
+  m_st->accumulator = NULL;
+
+  if (!NN::Enabled || !prev || prev + 1 == thisThread->accumulators + NN::StackSize)
+      return NULL;
+
+  m_st->accumulator = prev + 1;
+
+  if (prev->key != m_st->previous->key)
+      return NULL;
+
+  *m_st->accumulator = *prev;
+  return m_st->accumulator;
+}
+
+
 /// Position::do(undo)_null_move() is used to do(undo) a "null move": It flips
 /// the side to move without executing any move on the board.
 /*
@@ -1447,6 +1875,8 @@ void Position::do_null_move(StateInfo& newSt)
 
   newSt.previous = m_st;
   m_st = &newSt;
+
+  NN::Accumulator* acc = push_accumulator();
 	/*
 	ApbTH
 	*/
@@ -1461,6 +1891,9 @@ void Position::do_null_move(StateInfo& newSt)
   m_st->key ^= Zobrist::side;
   prefetch((char*)TT.first_entry(m_st->key));
 
+  if (acc)
+      acc->key = m_st->key;
+
   ++m_st->rule50;
 	/*
 	pliesFromNull̓k[ũJEgȂ̂łŃJEg[
@@ -1486,83 +1919,20 @@ void Position::undo_null_move()
 }
 
 
-/// Position::see() is a static exchange evaluator: It tries to estimate the
-/// material gain or loss resulting from a move. Parameter 'asymmThreshold' takes
-/// tempi into account. If the side who initiated the capturing sequence does the
-/// last capture, he loses a tempo and if the result is below 'asymmThreshold'
-/// the capturing sequence is considered bad.
-/*
-Î~T
-̎荇̕]AT[`gp̎荇ȂȂ܂ŕ]𑱂
-*/
-int Position::see_sign(Move m) const 
-{
-
-  assert(is_ok(m));
+/// Position::see_swap() is the second half of see(): given the attackers to
+/// 'to' once the piece on 'from' has been lifted, it plays out the capture
+/// sequence and negamaxes the swap list. It is shared by see() and see_signs().
 
-  // Early return if SEE cannot be negative because captured piece value
-  // is not less then capturing one. Note that king moves always return
-  // here because king midgame value is set to 0.
-	/*
-	Ԃ̎w̋liՁjꂩ낤ƂẲliՁj菬܂͓Ȃ
-	PŋAi艿l̏ŉl̑傫ȋ邱ƂOK炵
-	܂肱ȍ~̏(see֐Ăԏj͎w̋艿lꍇ
-	ƌƂɂȂ
-	*/
-  if (PieceValue[MG][moved_piece(m)] <= PieceValue[MG][piece_on(to_sq(m))])
-      return 1;
-
-  return see(m);
-}
-/*
-Î~T
-*/
-int Position::see(Move m, int asymmThreshold) const 
+FORCE_INLINE int Position::see_swap(Square from, Square to, Bitboard occupied, Bitboard attackers,
+                                    int captureValue, int asymmThreshold) const
 {
 
-  Square from, to;
-  Bitboard occupied, attackers, stmAttackers;
+  Bitboard stmAttackers;
   int swapList[32], slIndex = 1;
   PieceType captured;
-  Color stm;
+  Color stm = color_of(piece_on(from));
 
-  assert(is_ok(m));
-
-  from = from_sq(m);
-  to = to_sq(m);
-	/*
-	swapList̍ŏɂtoWɂ̉lĂiŏɎj
-	*/
-  swapList[0] = PieceValue[MG][piece_on(to)];
-  stm = color_of(piece_on(from));
-	/*
-	J[Ɋ֌WȂSbitboardAAfromɂ
-	*/
-  occupied = pieces() ^ from;
-
-  // Castle moves are implemented as king capturing the rook so cannot be
-  // handled correctly. Simply return 0 that is always the correct value
-  // unless in the rare case the rook ends up under attack.
-	/*
-	LXO֌WȂ牿l0ŕԂ
-	*/
-	if (type_of(m) == CASTLE)
-      return 0;
-	/*
-	wp^[ApbTȂswapListpawnĂ
-	*/
-	if (type_of(m) == ENPASSANT)
-  {
-      occupied ^= to - pawn_push(stm); // Remove the captured pawn
-      swapList[0] = PieceValue[MG][PAWN];
-  }
-
-  // Find all attackers to the destination square, with the moving piece
-  // removed, but possibly an X-ray attacker added behind it.
-	/*
-	ẅړɗĂbitboardattackersɓiJ[Ɋ֌WȂj
-	*/
-	attackers = attackers_to(to, occupied) & occupied;
+  swapList[0] = captureValue;
 
   // If the opponent has no attackers we are finished
 	/*
@@ -1649,6 +2019,156 @@ int Position::see(Move m, int asymmThreshold) const
   return swapList[0];
 }
 
+/// Position::see() is a static exchange evaluator: It tries to estimate the
+/// material gain or loss resulting from a move. Parameter 'asymmThreshold' takes
+/// tempi into account. If the side who initiated the capturing sequence does the
+/// last capture, he loses a tempo and if the result is below 'asymmThreshold'
+/// the capturing sequence is considered bad.
+/*
+Î~T
+̎荇̕]AT[`gp̎荇ȂȂ܂ŕ]𑱂
+*/
+int Position::see_sign(Move m) const 
+{
+
+  assert(is_ok(m));
+
+  // Early return if SEE cannot be negative because captured piece value
+  // is not less then capturing one. Note that king moves always return
+  // here because king midgame value is set to 0.
+	/*
+	Ԃ̎w̋liՁjꂩ낤ƂẲliՁj菬܂͓Ȃ
+	PŋAi艿l̏ŉl̑傫ȋ邱ƂOK炵
+	܂肱ȍ~̏(see֐Ăԏj͎w̋艿lꍇ
+	ƌƂɂȂ
+	*/
+  if (PieceValue[MG][moved_piece(m)] <= PieceValue[MG][piece_on(to_sq(m))])
+      return 1;
+
+  return see(m);
+}
+/*
+Î~T
+*/
+int Position::see(Move m, int asymmThreshold) const 
+{
+
+  Square from, to;
+  Bitboard occupied, attackers;
+  int captureValue;
+
+  assert(is_ok(m));
+
+  from = from_sq(m);
+  to = to_sq(m);
+	/*
+	swapList̍ŏɂtoWɂ̉lĂiŏɎj
+	*/
+  captureValue = PieceValue[MG][piece_on(to)];
+	/*
+	J[Ɋ֌WȂSbitboardAAfromɂ
+	*/
+  occupied = pieces() ^ from;
+
+  // Castle moves are implemented as king capturing the rook so cannot be
+  // handled correctly. Simply return 0 that is always the correct value
+  // unless in the rare case the rook ends up under attack.
+	/*
+	LXO֌WȂ牿l0ŕԂ
+	*/
+	if (type_of(m) == CASTLE)
+      return 0;
+	/*
+	wp^[ApbTȂswapListpawnĂ
+	*/
+	if (type_of(m) == ENPASSANT)
+  {
+      occupied ^= to - pawn_push(color_of(piece_on(from))); // Remove the captured pawn
+      captureValue = PieceValue[MG][PAWN];
+  }
+
+  // Find all attackers to the destination square, with the moving piece
+  // removed, but possibly an X-ray attacker added behind it.
+	/*
+	ẅړɗĂbitboardattackersɓiJ[Ɋ֌WȂj
+	*/
+#ifdef USE_ATTACK_MAPS
+  // With the attack maps we only need to add the x-ray attackers revealed
+  // behind the moving piece: they are the sliders attacking 'from' along the
+  // line to 'to'. En passant changes one more square, so compute it as usual.
+  if (type_of(m) != ENPASSANT)
+      attackers = (  attackersToBB[to]
+                   | (  attackersToBB[from] & LineBB[from][to] & ~SquareBB[to]
+                      & (pieces(BISHOP, ROOK) | pieces(QUEEN)))) & occupied;
+  else
+#endif
+	attackers = attackers_to(to, occupied) & occupied;
+
+  return see_swap(from, to, occupied, attackers, captureValue, asymmThreshold);
+}
+
+
+/// Position::see_signs() computes see_sign() for all the moves in [begin, end)
+/// in one pass and writes the results to 'signs'. MovePicker uses it to score
+/// evasions, where every move needs its sign before the first one is picked.
+/// Captures in the main search stay with a lazy see_sign() per picked move,
+/// because a cutoff usually comes before most of them are tried. Moves whose
+/// sign follows from the piece values alone never reach the swap loop; for
+/// the others the attackers to each destination square are computed once and
+/// shared, and only the X-ray attackers revealed behind the moving piece are
+/// added per move.
+
+void Position::see_signs(const ExtMove* begin, const ExtMove* end, int* signs) const
+{
+  Bitboard toAttackers[SQUARE_NB];
+  Bitboard done = 0;
+  const Bitboard sliders = pieces(BISHOP, ROOK) | pieces(QUEEN);
+
+  for (const ExtMove* it = begin; it != end; ++it, ++signs)
+  {
+      Move m = it->move;
+      Square from = from_sq(m), to = to_sq(m);
+      int captureValue = PieceValue[MG][piece_on(to)];
+
+      assert(is_ok(m));
+
+      // Same early return of see_sign(), castle moves are king moves so are
+      // always caught here too.
+      if (PieceValue[MG][moved_piece(m)] <= captureValue)
+      {
+          *signs = 1;
+          continue;
+      }
+
+      // En passant removes a second piece, rare enough to not be worth sharing
+      if (type_of(m) == ENPASSANT)
+      {
+          *signs = see(m);
+          continue;
+      }
+
+      if (!(done & to))
+      {
+          done |= to;
+          toAttackers[to] = attackers_to(to);
+      }
+
+      Bitboard occupied = pieces() ^ from;
+      Bitboard attackers = toAttackers[to];
+
+      // Lifting the moving piece can only uncover a slider on the line beyond it
+      if (LineBB[from][to] & sliders & ~SquareBB[to] & ~SquareBB[from])
+      {
+          if (PseudoAttacks[BISHOP][to] & from)
+              attackers |= attacks_bb<BISHOP>(to, occupied) & pieces(BISHOP, QUEEN);
+          else
+              attackers |= attacks_bb<ROOK>(to, occupied) & pieces(ROOK, QUEEN);
+      }
+
+      *signs = see_swap(from, to, occupied, attackers & occupied, captureValue, 0);
+  }
+}
+
 
 /// Position::clear() erases the position object to a pristine state, with an
 /// empty board, white to move, and no castling rights.
@@ -2101,6 +2621,16 @@ bool Position::pos_is_ok(int* failedStep) const
                   return false;
           }
 
+#ifdef USE_ATTACK_MAPS
+  const bool debugAttackMaps = all || false;
+
+  if ((*step)++, debugAttackMaps)
+      for (Square s = SQ_A1; s <= SQ_H8; ++s)
+          if (   attackersToBB[s] != attackers_to(s, pieces())
+              || attacksFromBB[s] != (empty(s) ? 0 : attacks_from(piece_on(s), s)))
+              return false;
+#endif
+
   *step = 0;
   return true;
 }
@@ -24,9 +24,17 @@
 #include <cstddef>
 
 #include "bitboard.h"
+#include "nn.h"
 #include "types.h"
 
 
+/// Zobrist keys of the pieces. Material::init() uses them to compute the
+/// material keys of configurations given by their piece counts.
+
+namespace Zobrist {
+  extern Key psq[COLOR_NB][PIECE_TYPE_NB][SQUARE_NB];
+}
+
 /// The checkInfo struct is initialized at c'tor time and keeps info used
 /// to detect if a move gives check.
 class Position;
@@ -103,6 +111,7 @@ struct StateInfo {
 	ЂƂ̃xւ̃N
 	*/
   StateInfo* previous;
+  NN::Accumulator* accumulator; // Slot in the thread's stack, NULL past its end
 };
 
 
@@ -115,6 +124,41 @@ offsetof
 const size_t StateCopySize64 = offsetof(StateInfo, key) / sizeof(uint64_t) + 1;
 
 
+/// FenError tells why Position::set() rejected a FEN or EPD record: 'what' is
+/// a static description and 'offset' the position in the record where the
+/// problem was found. Buffers passed to Position::fen() must hold at least
+/// MAX_FEN_LENGTH characters.
+
+struct FenError {
+  const char* what;
+  int offset;
+};
+
+const int MAX_FEN_LENGTH = 128;
+
+
+/// PackedPosition is a fixed size, 32 bytes, binary encoding of a position
+/// used for datasets, see packedpos.h for the file reader and writer. The
+/// occupied squares are a bitboard and 'pieces' holds a 4 bit Piece code for
+/// each of them, in square order and low nibble first. Rooks that still have
+/// castling rights use the spare code CastleRook (plus 8 for black), so that
+/// Chess960 castling needs no extra field. Multi-byte fields are stored in
+/// native (little endian on x86) order.
+
+struct PackedPosition {
+
+  enum { BlackToMove = 1, Chess960 = 2, CastleRook = 7 };
+
+  uint64_t occupied;
+  uint8_t  pieces[16];
+  uint8_t  flags;
+  uint8_t  epSquare;   // SQ_NONE if not set
+  uint16_t rule50;
+  uint16_t fullmove;
+  uint16_t reserved;   // Always zero, free for dataset specific use
+};
+
+
 /// The Position class stores the information regarding the board representation
 /// like pieces, side to move, hash keys, castling info, etc. The most important
 /// methods are do_move() and undo_move(), used by the search to update node info
@@ -131,7 +175,7 @@ public:
 	Zq̃I[o[[hĂ΂ỉɂ@`position.cppɂ
 	Ń[mۂpRs[Ăj
 	*/
-  Position(const Position& p, Thread* t) { *this = p; thisThread = t; }
+  Position(const Position& p, Thread* t);
 	/*
 	fen琶RXgN^,c960͕ό`[Kpǂflag
 	*/
@@ -168,11 +212,17 @@ public:
 	ɂ낢ǖʕێAǖʍXVɕKvȂ̂Ă邪
 	ڍוs
 	*/
-	void set(const std::string& fen, bool isChess960, Thread* th);
+  bool set(const char* fen, bool isChess960, Thread* th, FenError* err = NULL, const char** end = NULL);
+  bool set(const std::string& fen, bool isChess960, Thread* th, FenError* err = NULL) {
+    return set(fen.c_str(), isChess960, th, err);
+  }
+  bool set(const PackedPosition& pp, Thread* th, FenError* err = NULL);
+  void pack(PackedPosition& pp) const;
 	/*
 	݂̋ǖʂfenStrɕϊ
 	*/
 	const std::string fen() const;
+  char* fen(char* buf, bool epd = false) const;
 	/*
 	wƌ݂̋ǖʂ𕶎ɂĕԂ
 	*/
@@ -392,6 +442,7 @@ public:
 	Î~TH
 	*/
 	int see_sign(Move m) const;
+  void see_signs(const ExtMove* begin, const ExtMove* end, int* signs) const;
 
   // Accessing hash keys
 	/*
@@ -417,6 +468,7 @@ public:
 	psq͂̋ǖʂ̈ʒu]̏Wvl
 	*/
 	Score psq_score() const;
+  NN::Accumulator* accumulator() const;
 	/*
 	StateInfõo[npMaterial
 	*/
@@ -477,6 +529,8 @@ private:
 	LXO֌WH
 	*/
 	void set_castle_right(Color c, Square rfrom);
+  void set_state(bool isChess960, Thread* th);
+  NN::Accumulator* push_accumulator();
 
   // Helper functions
 	/*
@@ -491,6 +545,8 @@ private:
 	G̑pinĂ鎩Ԃ
 	*/
   Bitboard hidden_checkers(Square ksq, Color c, Color toMove) const;
+  int see_swap(Square from, Square to, Bitboard occupied, Bitboard attackers,
+               int captureValue, int asymmThreshold) const;
 	/*
 	ՂɋuƂɎgpAdo_move֐ȂǂŎgpAړ̏ł͂Ȃ̂Œ
 	*/
@@ -516,18 +572,30 @@ private:
   Score compute_psq_score() const;
   Value compute_non_pawn_material(Color c) const;
 
+#ifdef USE_ATTACK_MAPS
+  // Incremental update of the attack maps, see do_move() and undo_move()
+  Bitboard move_squares(Move m, Color us) const;
+  Bitboard detach_attacks(Bitboard changed);
+  void attach_attacks(Bitboard affected);
+  void compute_attack_maps();
+#endif
+
   // Board and pieces
 	/*
 	board֌W̎vϐ
 	*/
 	//Piece^̔zAUS
-	Piece board[SQUARE_NB];
+	// Board, counts, indices and castle masks are stored byte-packed (and Square
+	// itself is a single byte) so that the Position object copied at every split
+	// point, and touched at every node, stays small. Accessors convert back to
+	// the enum types.
+	uint8_t board[SQUARE_NB];
 	//킲ƂbitboardA͂UނȂW܂ŗvf
 	Bitboard byTypeBB[PIECE_TYPE_NB];
 	//J[Ƃbitboard
 	Bitboard byColorBB[COLOR_NB];
 	//J[ƁA킲Ƃ̋LĂz
-	int pieceCount[COLOR_NB][PIECE_TYPE_NB];
+	uint8_t pieceCount[COLOR_NB][PIECE_TYPE_NB];
 	//J[ƁA킲ƁAǂ̍Wɂ̂LĂz
 	Square pieceList[COLOR_NB][PIECE_TYPE_NB][16];
 	/*
@@ -540,15 +608,23 @@ private:
 	pieceList[c][pt][index[s]] = s;
 
 	*/
-	int index[SQUARE_NB];
+	uint8_t index[SQUARE_NB];
 
   // Other info
 	/*
 	LXO֌W̕ϐ
 	*/
-	int castleRightsMask[SQUARE_NB];
+	uint8_t castleRightsMask[SQUARE_NB];
   Square castleRookSquare[COLOR_NB][CASTLING_SIDE_NB];
   Bitboard castlePath[COLOR_NB][CASTLING_SIDE_NB];
+
+#ifdef USE_ATTACK_MAPS
+  // attacksFromBB[s] holds the squares attacked by the piece on square s and
+  // attackersToBB[s] the pieces, of both colors, attacking square s. Both are
+  // updated incrementally so that attackers_to() becomes a table lookup.
+  Bitboard attacksFromBB[SQUARE_NB];
+  Bitboard attackersToBB[SQUARE_NB];
+#endif
 	/*
 	Jnǖʂ̂߂StateInfoϐAPosition::clear֐
 	StateInfo* m_st|C^[
@@ -600,14 +676,14 @@ inline void Position::set_nodes_searched(int64_t n) {
 boardz̎wWɂR[hԂ
 */
 inline Piece Position::piece_on(Square s) const {
-  return board[s];
+  return Piece(board[s]);
 }
 /*
 f[^R[h擾
 ł͂Ȃ
 */
 inline Piece Position::moved_piece(Move m) const {
-  return board[from_sq(m)];
+  return Piece(board[from_sq(m)]);
 }
 /*
 board[]z̎w肵WɋȂtrueԂ
@@ -662,7 +738,7 @@ inline Bitboard Position::pieces(Color c, PieceType pt1, PieceType pt2) const {
 w肵J[A̐Ԃ
 */
 template<PieceType Pt> inline int Position::count(Color c) const {
-  return pieceCount[c][Pt];
+  return int(pieceCount[c][Pt]);
 }
 /*
 w肵J[A̍WXgԂ
@@ -739,7 +815,11 @@ inline Bitboard Position::attacks_from(Piece p, Square s) const {
 w肵WɗĂbitboardԂAJ[͖֌W
 */
 inline Bitboard Position::attackers_to(Square s) const {
+#ifdef USE_ATTACK_MAPS
+  return attackersToBB[s];
+#else
   return attackers_to(s, byTypeBB[ALL_PIECES]);
+#endif
 }
 /*
 checkersBB͎wKINGɉCheck|Ăbitboard
@@ -807,6 +887,10 @@ inline Key Position::material_key() const {
 inline Score Position::psq_score() const {
   return m_st->psq;
 }
+
+inline NN::Accumulator* Position::accumulator() const {
+  return m_st->accumulator;
+}
 /*
 PAWNKING]l
 */
@@ -418,6 +418,13 @@ size_t Search::perft(Position& pos, Depth depth)
   return depth > ONE_PLY ? ::perft(pos, depth) : MoveList<LEGAL>(pos).size();
 }
 
+/// Search::new_game() is called on 'ucinewgame' to forget the state kept
+/// between the moves of a game: the node budget of 'nodestime' and the last
+/// clock used to measure the latency.
+
+void Search::new_game() { TimeMgr.new_game(); }
+
+
 /// Search::think() is the external interface to Stockfish's search, and is
 /// called by the main thread when the program receives the UCI 'go' command. It
 /// searches from RootPos and at the end prints the "bestmove" to output.
@@ -430,6 +437,9 @@ void Search::think()
 
   static PolyglotBook book; // Defined static to initialize the PRNG only once
 
+  bool timed = Limits.use_time_management() && !Limits.ponder;
+  Time::point searchTime = 0;
+
   RootColor = RootPos.side_to_move();
 	/*
 	Ԑ̏AĂ΂x̂͋ǖʂɂĂǂ䂷邩Ă邩Ǝv
@@ -467,7 +477,8 @@ void Search::think()
 	*/
 	if (Options["OwnBook"] && !Limits.infinite && !Limits.mate)
   {
-      Move bookMove = book.probe(RootPos, Options["Book File"], Options["Best Book Move"]);
+      Move bookMove = book.probe(RootPos, Options["Book File"], Options["Best Book Move"],
+                                 Options["Book Preload"]);
 
       if (bookMove && std::count(RootMoves.begin(), RootMoves.end(), bookMove))
       {
@@ -521,7 +532,7 @@ void Search::think()
 	ƒTɕ̃XbhŒT؂T@Ă
 	*/
 	for (Thread* th : Threads)
-      th->maxPly = 0;
+      th->maxPly = th->completedDepth = 0;
 	/*
 	Options["Idle Threads Sleep"]falseB
 	TpXbhҋ@鎞sleepĂāAڊo߂̂̓VOiN̂A̓|[OԂ
@@ -541,6 +552,10 @@ void Search::think()
 	^C}[Xbh~Ă
 	*/
   Threads.timer->run = false; // Stop the timer
+  searchTime = Time::now() - SearchTime;
+
+  if (Limits.use_time_management())
+      TimeMgr.spend_nodes(RootPos.nodes_searched(), Limits.inc[RootColor]);
   Threads.sleepWhileIdle = true; // Send idle threads to sleep
 	/*
 	search̃OL^IvVtrueł΃ftHgłfalse
@@ -594,8 +609,20 @@ finalize:
 	sync_cout << "bestmove " << move_to_uci(RootMoves[0].pv[0], RootPos.is_chess960())
             << " ponder "  << move_to_uci(RootMoves[0].pv[1], RootPos.is_chess960())
             << sync_endl;
+
+  // Measure until the move has been handed to the OS, the search is over and
+  // nothing waits on us.
+  if (timed)
+  {
+      Output::flush();
+      TimeMgr.record_move(int(Time::now() - SearchTime), int(searchTime));
+  }
 }
 
+/// Search::latency_report() is called by the 'latency' command
+
+std::string Search::latency_report() { return TimeMgr.latency_report(); }
+
 
 namespace {
 
@@ -794,6 +821,9 @@ namespace {
 					sync_cout << uci_pv(pos, depth, alpha, beta) << sync_endl;
 			}//MultiPVI
 
+			if (!Signals.stop)
+				pos.this_thread()->completedDepth = depth;
+
 			// Do we need to pick now the sub-optimal best move ?
 			/*
 			XLx20 @time_to_pick ֐depthi[[xjXLxƓȂtrueȊO
@@ -863,7 +893,7 @@ namespace {
 				ToߎԂœKTԂ62%𒴂stop
 				Ȃ62%
 				*/
-				if (Time::now() - SearchTime > (TimeMgr.available_time() * 62) / 100)
+				if (TimeMgr.elapsed(RootPos.nodes_searched()) > (TimeMgr.available_time() * 62) / 100)
 					stop = true;
 
 				// Stop search early if one move seems to be much better than others
@@ -888,7 +918,7 @@ namespace {
 				&&  PVSize == 1
 				&&  bestValue > VALUE_MATED_IN_MAX_PLY
 				&& (   RootMoves.size() == 1
-				|| Time::now() - SearchTime > (TimeMgr.available_time() * 20) / 100))
+				|| TimeMgr.elapsed(RootPos.nodes_searched()) > (TimeMgr.available_time() * 20) / 100))
 				{
 					Value rBeta = bestValue - 2 * PawnValueMg;
 					ss->excludedMove = RootMoves[0].pv[0];
@@ -954,7 +984,7 @@ namespace {
     Depth ext, newDepth, predictedDepth;
     Value bestValue, value, ttValue, eval, nullValue, futilityValue;
     bool inCheck, givesCheck, pvMove, singularExtensionNode, improving;
-    bool captureOrPromotion, dangerous, doFullDepthSearch;
+    bool captureOrPromotion, dangerous, doFullDepthSearch, futilityCut = false;
     int moveCount, quietCount;
 
     // Step 1. Initialize node
@@ -1065,6 +1095,8 @@ namespace {
     posKey = excludedMove ? pos.exclusion_key() : pos.key();
     tte = TT.probe(posKey);
     ttMove = RootNode ? RootMoves[PVIdx].pv[0] : tte ? tte->move() : MOVE_NONE;
+    thisThread->ttProbes++;
+    thisThread->ttHits += (tte != NULL);
     ttValue = tte ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
 
     // At PV nodes we check for exact scores, while at non-PV nodes we check for
@@ -1151,7 +1183,32 @@ namespace {
 				ƓɃgX|WVe[uɌǖʂo^ĂA̎]lVALUE_NONEɐݒ肵Ă̂
 				̋ǖʂ̒T܂ςłȂiÎ~]lss->staticEvalŗ^Ă邱̐Î~]lo֐tte->eval_value()j
 				*/
-        eval = ss->staticEval = evaluate(pos);
+        // When step 7 is going to prune this node a lower bound of the static
+        // evaluation is enough, so pass the futility threshold to evaluate()
+        // and return once the TT store below is done. The value reaching the
+        // threshold may be a lazy bound up to 2 * LazyMargin below the exact
+        // evaluation, so VALUE_NONE is stored as the static eval and the
+        // gains update is skipped, as in qsearch() after a stand pat cut.
+        if (   !PvNode
+            && !ss->skipNullMove
+            &&  depth < 7 * ONE_PLY
+            &&  abs(beta) < VALUE_MATE_IN_MAX_PLY
+            &&  pos.non_pawn_material(pos.side_to_move()))
+        {
+            eval = evaluate(pos, -VALUE_INFINITE, beta + futility_margin(depth));
+
+            if (eval >= beta + futility_margin(depth))
+            {
+                if (eval < VALUE_KNOWN_WIN)
+                    futilityCut = true;
+                else
+                    eval = evaluate(pos);
+            }
+        }
+        else
+            eval = evaluate(pos);
+
+        ss->staticEval = futilityCut ? VALUE_NONE : eval;
         TT.store(posKey, VALUE_NONE, BOUND_NONE, DEPTH_NONE, MOVE_NONE, ss->staticEval);
     }
 		/*
@@ -1172,6 +1229,9 @@ namespace {
         Gains.update(pos.piece_on(to), to, -(ss-1)->staticEval - ss->staticEval);
     }
 
+    if (futilityCut)
+        return eval - futility_margin(depth);
+
     // Step 6. Razoring (skipped when in check)
 		/*
 		Razoring}
@@ -2103,6 +2163,8 @@ moves_loop: // When in check and at SpNode search starts from here
 		posKey = pos.key();
     tte = TT.probe(posKey);
     ttMove = tte ? tte->move() : MOVE_NONE;
+    pos.this_thread()->ttProbes++;
+    pos.this_thread()->ttHits += (tte != NULL);
     ttValue = tte ? value_from_tt(tte->value(),ss->ply) : VALUE_NONE;
 		/*
 		gX|WVe[u̎̕]l^lȂgX|WVe[u̕]lԂ
@@ -2149,14 +2211,16 @@ moves_loop: // When in check and at SpNode search starts from here
                     bestValue = ttValue;
         }
         else
-            ss->staticEval = bestValue = evaluate(pos);
+            ss->staticEval = bestValue = evaluate(pos, -VALUE_INFINITE, beta);
 
-        // Stand pat. Return immediately if static value is at least beta
+        // Stand pat. Return immediately if static value is at least beta. In
+        // that case the evaluation may have stopped early, so the value is
+        // only a lower bound and is not stored in TT as the static eval.
         if (bestValue >= beta)
         {
             if (!tte)
                 TT.store(pos.key(), value_to_tt(bestValue, ss->ply), BOUND_LOWER,
-                         DEPTH_NONE, MOVE_NONE, ss->staticEval);
+                         DEPTH_NONE, MOVE_NONE, VALUE_NONE);
 
             return bestValue;
         }
@@ -2843,7 +2907,7 @@ void check_time()
 	/*
 	WJm[hɂT~̂߁AT򂵂m[hWv
 	*/
-  if (Limits.nodes)
+  if (Limits.nodes || TimeMgr.use_nodes())
   {
       Threads.mutex.lock();
 
@@ -2890,7 +2954,7 @@ void check_time()
 	nodesIvVAݒ肵ĂWJm[h𒴂ƒT~
 
 	*/
-  Time::point elapsed = Time::now() - SearchTime;
+  Time::point elapsed = TimeMgr.elapsed(nodes);
   bool stillAtFirstMove =    Signals.firstRootMove
                          && !Signals.failedLowAtRoot
                          &&  elapsed > TimeMgr.available_time();
@@ -128,6 +128,8 @@ extern StateStackPtr SetupStates;
 extern void init();
 extern size_t perft(Position& pos, Depth depth);
 extern void think();
+extern void new_game();
+extern std::string latency_report();
 
 } // namespace Search
 
@@ -115,6 +115,10 @@ Thread::Thread() /* : splitPoints() */
   maxPly = splitPointsSize = 0;
   activeSplitPoint = nullptr;
   activePosition = nullptr;
+  kingSafetyStats = Pawns::KingSafetyStats();
+  ttProbes = ttHits = 0;
+  splits = splitHelpers = splitCutoffs = 0;
+  completedDepth = 0;
   idx = Threads.size();
 }
 
@@ -285,7 +289,7 @@ void ThreadPool::exit()
 // read_uci_options() updates internal threads parameters from the corresponding
 // UCI options and creates/destroys threads to match the requested number. Thread
 // objects are dynamically allocated to avoid creating in advance all possible
-// threads, with included pawns and material tables, if only few are used.
+// threads, with included pawn tables, if only few are used.
 /*
 ThreadPoolinit֐Ă΂i͂P񂾂jAuci option Min Split Depth,Max Threads per Split Point,Threads
 IvVύXꂽ琏Ă΂B
@@ -326,6 +330,27 @@ void ThreadPool::read_uci_options()
       delete_thread(back());
       pop_back();
   }
+
+  for (Thread* th : *this)
+  {
+      th->evalCache.resize(Options["Eval Cache"]);
+      th->pawnsTable.resize_kb(Options["Pawn Hash"], Options["Pawn Hash Ways"]);
+  }
+}
+
+
+// clear_eval_caches() empties the per-thread evaluation caches, called when
+// a change of the evaluation weights makes the cached values stale.
+
+void ThreadPool::clear_eval_caches() {
+
+  for (Thread* th : *this)
+  {
+      th->evalCache.clear();
+
+      for (NN::Accumulator& acc : th->accumulators)
+          acc.key = 0;
+  }
 }
 
 
@@ -430,6 +455,7 @@ void Thread::split(Position& pos, const Stack* ss, Value alpha, Value beta, Valu
   {
 			//slavesMaskɎ̃}X^[XbhidxƎŗLidxL^Ă
       sp.slavesMask |= 1ULL << slave->idx;
+      ++splitHelpers;
       slave->activeSplitPoint = &sp;
 			//擾XbhThread::idle_loop֐ɂ̂ŁAsearching=trueŒTJn
       slave->searching = true; // Slave leaves idle_loop()
@@ -447,6 +473,7 @@ void Thread::split(Position& pos, const Stack* ss, Value alpha, Value beta, Valu
 	*/
   if (slavesCnt > 1 || Fake)
   {
+      ++splits;
       sp.mutex.unlock();
       Threads.mutex.unlock();
 			/*
@@ -474,6 +501,7 @@ void Thread::split(Position& pos, const Stack* ss, Value alpha, Value beta, Valu
   activeSplitPoint = sp.parentSplitPoint;
   activePosition = &pos;
   pos.set_nodes_searched(pos.nodes_searched() + sp.nodes);
+  splitCutoffs += sp.cutoff;
   *bestMove = sp.bestMove;
   *bestValue = sp.bestValue;
 
@@ -25,6 +25,7 @@
 #include <thread>
 #include <vector>
 
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
@@ -150,14 +151,18 @@ struct Thread : public ThreadBase {
 	*/
   SplitPoint splitPoints[MAX_SPLITPOINTS_PER_THREAD];
   Material::Table materialTable;
-  Endgames endgames;
   Pawns::Table pawnsTable;
+  Pawns::KingSafetyStats kingSafetyStats;
+  uint64_t ttProbes, ttHits;
+  uint64_t splits, splitHelpers, splitCutoffs;
+  Eval::Cache evalCache;
+  NN::Accumulator accumulators[NN::StackSize];
   Position* activePosition;
 	/*
 	XbhŗLID
 	*/
   size_t idx;
-  int maxPly;
+  int maxPly, completedDepth;
   SplitPoint* volatile activeSplitPoint;
 	/*
 	T򂵂XbhƂɎĂsplitPointsz̃CfbNX
@@ -220,6 +225,7 @@ struct ThreadPool : public std::vector<Thread*> {
 	uci_optionXbhɊւIvV
 	*/
   void read_uci_options();
+  void clear_eval_caches();
 	/*
 	prs
 	*/
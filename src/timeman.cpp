@@ -26,6 +26,8 @@ TimeManager TimeMgr;
 
 #include <algorithm>
 #include <cmath>
+#include <sstream>
+#include <vector>
 
 #include "search.h"
 #include "timeman.h"
@@ -118,6 +120,25 @@ think
 limitsname space searchɂĒTɐFXȐ|邽߂̍\
 قƂǗprsAoIȂ̂
 */
+/// TimeManager::elapsed() returns the time spent on this search, in nodes
+/// converted to milliseconds when 'nodestime' is set.
+
+Time::point TimeManager::elapsed(int64_t nodes) const {
+
+  return npmsec ? nodes / npmsec : Time::now() - Search::SearchTime;
+}
+
+
+/// TimeManager::spend_nodes() updates the node budget of the game at the end
+/// of a search. The budget is kept positive, a zero means a new game.
+
+void TimeManager::spend_nodes(int64_t nodes, int inc) {
+
+  if (npmsec)
+      availableNodes = std::max(int64_t(1), availableNodes + int64_t(inc) * npmsec - nodes);
+}
+
+
 void TimeManager::init(const Search::LimitsType& limits, int currentPly, Color us)
 {
   /* We support four different kind of time controls:
@@ -152,6 +173,37 @@ void TimeManager::init(const Search::LimitsType& limits, int currentPly, Color u
   int emergencyMoveTime    = Options["Emergency Move Time"];
   int minThinkingTime      = Options["Minimum Thinking Time"];
   int slowMover            = Options["Slow Mover"];
+  int myTime               = limits.time[us];
+
+  npmsec = limits.use_time_management() ? int(Options["nodestime"]) : 0;
+
+  if (npmsec)
+  {
+      if (!availableNodes) // First move of the game
+          availableNodes = int64_t(npmsec) * myTime;
+
+      myTime = int(availableNodes / npmsec);
+  }
+
+  // Complete the sample of our last move with the color with what the GUI
+  // clock charged for it, unless a 'movestogo' control has just refilled the
+  // clock. Colors are kept apart in case we play both sides.
+  if (   limits.use_time_management() && prevThink[us] >= 0 && prevTime[us] > 0
+      && sampleCnt - prevSample[us] <= LatencySamples)
+  {
+      int charged = prevTime[us] + prevInc[us] - limits.time[us];
+
+      if (charged >= 0 && charged <= prevTime[us])
+          samples[prevSample[us] % LatencySamples].transport = std::max(0, charged - prevThink[us]);
+  }
+
+  moveColor = us;
+  prevTime[us] = limits.time[us];
+  prevInc[us] = limits.inc[us];
+  prevThink[us] = -1;
+
+  // Node budgets are not charged any latency
+  int lag = !npmsec && Options["Latency Compensation"] ? latency() : 0;
 
   // Initialize to maximum values but unstablePVExtraTime that is reset
   unstablePVExtraTime = 0;
@@ -159,7 +211,7 @@ void TimeManager::init(const Search::LimitsType& limits, int currentPly, Color u
 	limits.timegoR}ĥƂ̃IvVŌ肳
 	go wtime x go btime xŎԂwiPʂmsec)
 	*/
-  optimumSearchTime = maximumSearchTime = limits.time[us];
+  optimumSearchTime = maximumSearchTime = myTime;
 
   // We calculate optimum time usage for different hypothetic "moves to go"-values and choose the
   // minimum of calculated search time values. Usually the greatest hypMTG gives the minimum values.
@@ -187,10 +239,11 @@ void TimeManager::init(const Search::LimitsType& limits, int currentPly, Color u
 				- emergencyBaseTime=60
 				- emergencyMoveTime=30*min(hypMTG,40)
 			*/
-      hypMyTime =  limits.time[us]
+      hypMyTime =  myTime
                  + limits.inc[us] * (hypMTG - 1)
                  - emergencyBaseTime
-                 - emergencyMoveTime * std::min(hypMTG, emergencyMoveHorizon);
+                 - emergencyMoveTime * std::min(hypMTG, emergencyMoveHorizon)
+                 - lag * hypMTG;
 
       hypMyTime = std::max(hypMyTime, 0);
 
@@ -209,6 +262,83 @@ void TimeManager::init(const Search::LimitsType& limits, int currentPly, Color u
 }
 
 
+const int TimeManager::LatencySamples;
+
+
+/// TimeManager::record_move() is called once 'bestmove' has been written,
+/// with the time since 'go' and the time spent searching, in milliseconds.
+
+void TimeManager::record_move(int thinkTime, int searchTime) {
+
+  prevSample[moveColor] = sampleCnt;
+  prevThink[moveColor] = thinkTime;
+
+  LatencySample& s = samples[sampleCnt++ % LatencySamples];
+  s.engine = std::max(0, thinkTime - searchTime);
+  s.transport = -1;
+}
+
+
+/// TimeManager::latency() returns the 90th percentile of the total latency of
+/// the last moves, the time we should reserve for each move on top of the
+/// search. The transport part is taken as 0 when the clock did not tell.
+
+int TimeManager::latency() const {
+
+  std::vector<int> v;
+
+  for (int i = 0; i < std::min(sampleCnt, LatencySamples); ++i)
+      v.push_back(samples[i].engine + std::max(0, samples[i].transport));
+
+  if (v.empty())
+      return 0;
+
+  std::vector<int>::iterator p = v.begin() + (v.size() * 9) / 10;
+  std::nth_element(v.begin(), p, v.end());
+  return *p;
+}
+
+
+/// TimeManager::latency_report() describes the distribution of the measured
+/// latencies as an UCI info string.
+
+std::string TimeManager::latency_report() const {
+
+  std::vector<int> engine, transport;
+  std::stringstream ss;
+
+  for (int i = 0; i < std::min(sampleCnt, LatencySamples); ++i)
+  {
+      engine.push_back(samples[i].engine);
+
+      if (samples[i].transport >= 0)
+          transport.push_back(samples[i].transport);
+  }
+
+  ss << "info string latency moves " << engine.size();
+
+  for (std::vector<int>* v : { &engine, &transport })
+  {
+      ss << (v == &engine ? " engine" : " transport");
+
+      if (v->empty())
+      {
+          ss << " none";
+          continue;
+      }
+
+      std::sort(v->begin(), v->end());
+      ss << " min "    << v->front()
+         << " median " << (*v)[v->size() / 2]
+         << " p90 "    << (*v)[(v->size() * 9) / 10]
+         << " max "    << v->back();
+  }
+
+  ss << " compensation " << latency() << " ms";
+  return ss.str();
+}
+
+
 namespace {
 	/*
 	remaininǵućvƌӖ@cꂽTԁH
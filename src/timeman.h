@@ -22,20 +22,54 @@
 #ifndef TIMEMAN_H_INCLUDED
 #define TIMEMAN_H_INCLUDED
 
+#include <string>
+
 /// The TimeManager class computes the optimal time to think depending on the
-/// maximum available time, the move game number and other parameters.
+/// maximum available time, the move game number and other parameters. With
+/// the 'nodestime' option set, time is counted in nodes instead: the clock
+/// of the first move is converted to a node budget for the whole game, each
+/// search spends the nodes it visits and gains its increment, and elapsed()
+/// turns the nodes searched so far back into milliseconds. So the engine plays
+/// the same whatever the load of the host.
+///
+/// The manager also measures, over the last moves, the latency that is not
+/// part of the search: from the end of the search to 'bestmove' reaching the
+/// pipe (engine side), and what the GUI clock charged us on top of our own
+/// go-to-bestmove time (transport and GUI side). When 'Latency Compensation'
+/// is on, a high percentile of their sum is reserved for every move to come.
 
 class TimeManager {
+
+  static const int LatencySamples = 64;
+
+  struct LatencySample {
+    int engine, transport; // Transport is -1 until the next clock is known
+  };
+
 public:
   void init(const Search::LimitsType& limits, int currentPly, Color us);
   void pv_instability(double bestMoveChanges);
   int available_time() const { return optimumSearchTime + unstablePVExtraTime; }
   int maximum_time() const { return maximumSearchTime; }
+  bool use_nodes() const { return npmsec != 0; }
+  Time::point elapsed(int64_t nodes) const;
+  void spend_nodes(int64_t nodes, int inc);
+  void new_game() { availableNodes = 0; prevThink[WHITE] = prevThink[BLACK] = -1; }
+  void record_move(int thinkTime, int searchTime);
+  int latency() const;
+  std::string latency_report() const;
 
 private:
   int optimumSearchTime;
   int maximumSearchTime;
   int unstablePVExtraTime;
+  int npmsec;             // Nodes per millisecond, 0 when timing on the clock
+  int64_t availableNodes; // Node budget left for the game
+  LatencySample samples[LatencySamples];
+  int sampleCnt;
+  Color moveColor;
+  int prevTime[COLOR_NB], prevInc[COLOR_NB], prevThink[COLOR_NB]; // Our last move
+  int prevSample[COLOR_NB];
 };
 
 #endif // #ifndef TIMEMAN_H_INCLUDED
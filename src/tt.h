@@ -107,6 +107,7 @@ public:
 	void set_size(size_t mbSize);
 	void clear();
 	void store(const Key key, Value v, Bound type, Depth d, Move m, Value statV);
+	uint32_t entries() const { return hashMask + ClusterSize; }
 
 	private:
 	uint32_t hashMask;
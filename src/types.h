@@ -34,6 +34,9 @@
 /// -DUSE_POPCNT  | Add runtime support for use of popcnt asm-instruction. Works
 ///               | only in 64-bit mode. For compiling requires hardware with
 ///               | popcnt support.
+///
+/// -DUSE_ATTACK_MAPS | Maintain incrementally updated attack maps in Position,
+///                   | attackers_to() and see() then read them directly.
 
 #include <cassert>
 #include <cctype>
@@ -77,9 +80,11 @@ PEXT
 BMI2 (Bit Manipulation Instruction Set 2)
 http://en.wikipedia.org/wiki/Bit_Manipulation_Instruction_Sets#BMI2_.28Bit_Manipulation_Instruction_Set_2.29
 */
-#if defined(USE_PEXT)
-#  include <immintrin.h> // Header for _pext_u64() intrinsic
-#else
+#if defined(USE_PEXT) || defined(USE_AVX2)
+#  include <immintrin.h> // Header for _pext_u64() and AVX2 intrinsics
+#endif
+
+#if !defined(USE_PEXT)
 #  define _pext_u64(b, m) (0)
 #endif
 
@@ -313,7 +318,9 @@ enum Depth {
 Wԍ
 0-63
 */
-enum Square {
+// Square has a byte sized underlying type so that square arrays, like the
+// Position piece lists, are packed. Values fit in [-128, 127] as deltas do.
+enum Square : int8_t {
   SQ_A1, SQ_B1, SQ_C1, SQ_D1, SQ_E1, SQ_F1, SQ_G1, SQ_H1,
   SQ_A2, SQ_B2, SQ_C2, SQ_D2, SQ_E2, SQ_F2, SQ_G2, SQ_H2,
   SQ_A3, SQ_B3, SQ_C3, SQ_D3, SQ_E3, SQ_F3, SQ_G3, SQ_H3,
@@ -366,7 +373,7 @@ stockfish
 */
 enum Score : int { SCORE_ZERO };
 
-inline Score make_score(int mg, int eg) { return Score((mg << 16) + eg); }
+constexpr Score make_score(int mg, int eg) { return Score((mg << 16) + eg); }
 
 /// Extracting the signed lower and upper 16 bits it not so trivial because
 /// according to the standard a simple cast to short is implementation defined
@@ -32,6 +32,10 @@
 using namespace std;
 
 extern void benchmark(const Position& pos, istream& is);
+extern void pack_fens(istream& is);
+extern void make_book(istream& is);
+extern void micro_benchmark(istream& is);
+extern void tt_benchmark(istream& is);
 
 namespace {
 
@@ -138,14 +142,19 @@ void UCI::loop(const string& args)
           Search::RootColor = pos.side_to_move(); // Ensure it is set
           sync_cout << Eval::trace(pos) << sync_endl;
       }
-      else if (token == "ucinewgame") { /* Avoid returning "Unknown command" */ }
+      else if (token == "ucinewgame") Search::new_game();
       else if (token == "go")         go(pos, is);
       else if (token == "position")   position(pos, is);
       else if (token == "setoption")  setoption(is);
       else if (token == "flip")       pos.flip();
       else if (token == "bench")      benchmark(pos, is);
+      else if (token == "pack")       pack_fens(is);
+      else if (token == "makebook")   make_book(is);
+      else if (token == "microbench") micro_benchmark(is);
+      else if (token == "ttbench")    tt_benchmark(is);
       else if (token == "d")          sync_cout << pos.pretty() << sync_endl;
       else if (token == "isready")    sync_cout << "readyok" << sync_endl;
+      else if (token == "latency")    sync_cout << Search::latency_report() << sync_endl;
 			else if (token == "debug"){		//2015/5ǉ
 				printf("Signals.stop = %d\n", Search::Signals.stop);
 				printf("Limits.depth = %d\n", Search::Limits.depth);
@@ -189,7 +198,19 @@ namespace {
     else
         return;
 
-    pos.set(fen, Options["UCI_Chess960"], Threads.main());
+    // Parse into a scratch object so that a bad FEN leaves the current
+    // position untouched.
+    Position newPos;
+    FenError err;
+
+    if (!newPos.set(fen, Options["UCI_Chess960"], Threads.main(), &err))
+    {
+        sync_cout << "info string Invalid FEN: " << err.what
+                  << " at column " << err.offset + 1 << sync_endl;
+        return;
+    }
+
+    pos = newPos;
 		/*
 		StateInfoev[gp[^ɂstackRei𐶐Ă
 		StateStackPtrɕϊĂB
@@ -21,8 +21,10 @@
 #include <cassert>
 #include <sstream>
 
+#include "bitboard.h"
 #include "evaluate.h"
 #include "misc.h"
+#include "nn.h"
 #include "thread.h"
 #include "tt.h"
 #include "ucioption.h"
@@ -35,10 +37,29 @@ namespace UCI {
 
 /// 'On change' actions, triggered by an option's value change
 void on_logger(const Option& o) { start_logger(o); }
-void on_eval(const Option&) { Eval::init(); }
+void on_log_rotation(const Option& o) { set_log_rotation(size_t(int(o)) << 20); }
+void on_eval(const Option&) { Eval::init(); Threads.clear_eval_caches(); }
 void on_threads(const Option&) { Threads.read_uci_options(); }
 void on_hash_size(const Option& o) { TT.set_size(o); }
 void on_clear_hash(const Option&) { TT.clear(); }
+void on_bitbase_path(const Option& o) { Bitbases::init(o); Threads.clear_eval_caches(); }
+void on_nn_eval(const Option& o) {
+
+  NN::set_enabled(o);
+  Threads.clear_eval_caches();
+
+  if (o && !NN::Enabled)
+      sync_cout << "info string NN Eval needs a valid NN File" << sync_endl;
+}
+
+void on_nn_file(const Option& o) {
+
+  if (!std::string(o).empty() && !NN::load(o))
+      sync_cout << "info string Unable to load NN weights from " << std::string(o) << sync_endl;
+
+  NN::set_enabled(Options["NN Eval"]);
+  Threads.clear_eval_caches();
+}
 
 
 /// Our case insensitive less() function as required by UCI protocol
@@ -71,8 +92,13 @@ void init(OptionsMap& o)
   o["Write Debug Log"]             = Option(false, on_logger);
   o["Write Search Log"]            = Option(false);
   o["Search Log Filename"]         = Option("SearchLog.txt");
+  o["Log Rotate Size"]             = Option(16, 1, 4096, on_log_rotation);
   o["Book File"]                   = Option("book.bin");
+  o["Bitbase Path"]                = Option("", on_bitbase_path);
+  o["NN File"]                     = Option("", on_nn_file);
+  o["NN Eval"]                     = Option(false, on_nn_eval);
   o["Best Book Move"]              = Option(false);
+  o["Book Preload"]                = Option(false);
   o["Contempt Factor"]             = Option(0, -50,  50);
   o["Mobility (Midgame)"]          = Option(100, 0, 200, on_eval);
   o["Mobility (Endgame)"]          = Option(100, 0, 200, on_eval);
@@ -86,6 +112,9 @@ void init(OptionsMap& o)
   o["Min Split Depth"]             = Option(0, 0, 12, on_threads);
   o["Max Threads per Split Point"] = Option(5, 4,  8, on_threads);
   o["Threads"]                     = Option(5, 1, MAX_THREADS, on_threads);	//1->5
+  o["Eval Cache"]                  = Option(0, 0, 1024, on_threads);
+  o["Pawn Hash"]                   = Option(int(Pawns::Table::default_kb()), 1, 262144, on_threads);
+  o["Pawn Hash Ways"]              = Option(1, 1, 2, on_threads);
   o["Idle Threads Sleep"]          = Option(false);
   o["Hash"]                        = Option(32, 1, 8192, on_hash_size);
   o["Clear Hash"]                  = Option(on_clear_hash);
@@ -98,6 +127,8 @@ void init(OptionsMap& o)
   o["Emergency Move Time"]         = Option(30, 0, 5000);
   o["Minimum Thinking Time"]       = Option(20, 0, 5000);
   o["Slow Mover"]                  = Option(70, 10, 1000);
+  o["nodestime"]                   = Option(0, 0, 10000);
+  o["Latency Compensation"]        = Option(true);
   o["UCI_Chess960"]                = Option(false);
   o["UCI_AnalyseMode"]             = Option(false, on_eval);
 }